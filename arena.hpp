@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/** Counters of the allocations made for trees
+ *
+ * heap_allocations counts the tree allocations that went to the global
+ * heap, arena_allocations the ones served by an Arena and arena_blocks the
+ * blocks that arenas had to request from the global heap. Once arenas are
+ * warmed up, a generation should not increase heap_allocations nor
+ * arena_blocks. */
+struct allocation_counters
+{
+    std::atomic<unsigned long> heap_allocations;
+    std::atomic<unsigned long> arena_allocations;
+    std::atomic<unsigned long> arena_blocks;
+
+    allocation_counters()
+        : heap_allocations(0), arena_allocations(0), arena_blocks(0) {}
+
+    void reset()
+    {
+        heap_allocations = 0;
+        arena_allocations = 0;
+        arena_blocks = 0;
+    }
+};
+
+/** Getter for the process-wide allocation counters */
+inline allocation_counters & get_allocation_counters()
+{
+    static allocation_counters counters;
+    return counters;
+}
+
+/** A bump allocator
+ *
+ * Memory is handed out linearly from large blocks and is never freed
+ * individually. reset() makes the whole arena available again in O(1),
+ * keeping its blocks, so that a warmed up arena does not touch the global
+ * heap anymore. Everything allocated from the arena must have been
+ * destroyed before it is reset. */
+class Arena
+{
+    private:
+        struct block
+        {
+            char *data;
+            std::size_t size;
+        };
+
+        /// The blocks owned by the arena
+        std::vector<block> blocks;
+        /// The block allocations are currently made from
+        std::size_t current = 0;
+        /// The offset of the first free byte in the current block
+        std::size_t offset = 0;
+        /// The minimal size of a new block
+        std::size_t block_size;
+
+    public:
+        explicit Arena(std::size_t block_size = 1 << 20)
+            : block_size(block_size) {}
+        Arena(const Arena &) = delete;
+        Arena & operator=(const Arena &) = delete;
+        ~Arena()
+        {
+            for(block &b : blocks)
+                ::operator delete(b.data);
+        }
+
+        /** Allocates memory from the arena
+         * \param bytes The number of bytes to allocate
+         * \param alignment The alignment of the returned pointer
+         * \return A pointer to the allocated memory */
+        void * allocate(std::size_t bytes, std::size_t alignment)
+        {
+            get_allocation_counters().arena_allocations.fetch_add(
+                    1, std::memory_order_relaxed);
+            while(true)
+            {
+                if(current < blocks.size())
+                {
+                    std::size_t start = (offset + alignment - 1)
+                        & ~(alignment - 1);
+                    if(start + bytes <= blocks[current].size)
+                    {
+                        offset = start + bytes;
+                        return blocks[current].data + start;
+                    }
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+                std::size_t size = bytes + alignment > block_size ?
+                    bytes + alignment : block_size;
+                get_allocation_counters().arena_blocks.fetch_add(
+                        1, std::memory_order_relaxed);
+                blocks.push_back({static_cast<char*>(::operator new(size)),
+                                  size});
+            }
+        }
+
+        /** Makes all the memory of the arena available again */
+        void reset()
+        {
+            current = 0;
+            offset = 0;
+        }
+
+        /** Getter for the number of bytes reserved by the arena */
+        std::size_t capacity() const
+        {
+            std::size_t total = 0;
+            for(const block &b : blocks)
+                total += b.size;
+            return total;
+        }
+};
+
+/** Getter for the arena tree allocations of this thread are made from
+ * \return A reference to the current arena, nullptr for the global heap */
+inline Arena *& current_arena()
+{
+    static thread_local Arena *arena = nullptr;
+    return arena;
+}
+
+/** Makes tree allocations of this thread use a given arena (or the global
+ * heap if it is nullptr) for the lifetime of the scope */
+class arena_scope
+{
+    private:
+        Arena *previous;
+    public:
+        explicit arena_scope(Arena *arena) : previous(current_arena())
+        { current_arena() = arena; }
+        arena_scope(const arena_scope &) = delete;
+        arena_scope & operator=(const arena_scope &) = delete;
+        ~arena_scope() { current_arena() = previous; }
+};
+
+/** Allocator used for the nodes of trees
+ *
+ * It allocates from the arena that was current when it was created, or
+ * from the global heap if there was none. Containers and shared pointers
+ * keep their allocator, so memory always goes back where it came from. */
+template<typename U>
+class tree_allocator
+{
+    private:
+        Arena *arena;
+
+        template<typename V> friend class tree_allocator;
+
+    public:
+        typedef U value_type;
+
+        tree_allocator() : arena(current_arena()) {}
+        explicit tree_allocator(Arena *arena) : arena(arena) {}
+        template<typename V>
+        tree_allocator(const tree_allocator<V> &other) : arena(other.arena) {}
+
+        U * allocate(std::size_t n)
+        {
+            if(arena)
+                return static_cast<U*>(
+                        arena->allocate(n * sizeof(U), alignof(U)));
+            get_allocation_counters().heap_allocations.fetch_add(
+                    1, std::memory_order_relaxed);
+            return static_cast<U*>(::operator new(n * sizeof(U)));
+        }
+
+        void deallocate(U *p, std::size_t)
+        {
+            if(!arena)
+                ::operator delete(p);
+        }
+
+        template<typename V>
+        bool operator==(const tree_allocator<V> &other) const
+        { return arena == other.arena; }
+        template<typename V>
+        bool operator!=(const tree_allocator<V> &other) const
+        { return arena != other.arena; }
+};
+
+/** Creates a tree in the current arena
+ * \param args The arguments forwarded to the constructor of tree_t
+ * \return A shared pointer to the new tree */
+template<typename tree_t, typename... Args>
+std::shared_ptr<tree_t> make_tree(Args&&... args)
+{
+    return std::allocate_shared<tree_t>(tree_allocator<tree_t>(),
+                                        std::forward<Args>(args)...);
+}
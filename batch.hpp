@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bytecode.hpp"
+
+/** A set of fitness cases stored as structure of arrays
+ *
+ * inputs[i][row] is the value of variable i in a given row and targets[row]
+ * the expected output for that row. */
+template<typename value_t>
+struct Dataset
+{
+    std::vector<std::vector<value_t>> inputs;
+    std::vector<value_t> targets;
+
+    Dataset() {}
+    Dataset(std::vector<std::vector<value_t>> inputs,
+            std::vector<value_t> targets = std::vector<value_t>())
+        : inputs(inputs), targets(targets) {}
+
+    /** Getter for the number of fitness cases */
+    std::size_t rows() const
+    { return inputs.empty() ? targets.size() : inputs[0].size(); }
+
+    /** Getter for pointers to the input columns */
+    std::vector<const value_t*> columns() const
+    {
+        std::vector<const value_t*> result;
+        for(const std::vector<value_t> &column : inputs)
+            result.push_back(column.data());
+        return result;
+    }
+};
+
+/** Kernels applying one instruction to a whole column of values
+ *
+ * The generic versions are plain loops, double has vectorized versions
+ * using AVX or SSE2 when they are enabled at compile time. out may alias
+ * the inputs. */
+namespace kernels
+{
+    template<typename value_t>
+    void fill(value_t *out, value_t value, std::size_t n)
+    { std::fill(out, out + n, value); }
+
+    template<typename value_t>
+    void add(value_t *out, const value_t *a, const value_t *b, std::size_t n)
+    { for(std::size_t i = 0; i < n; i++) out[i] = a[i] + b[i]; }
+
+    template<typename value_t>
+    void sub(value_t *out, const value_t *a, const value_t *b, std::size_t n)
+    { for(std::size_t i = 0; i < n; i++) out[i] = a[i] - b[i]; }
+
+    template<typename value_t>
+    void mul(value_t *out, const value_t *a, const value_t *b, std::size_t n)
+    { for(std::size_t i = 0; i < n; i++) out[i] = a[i] * b[i]; }
+
+    template<typename value_t>
+    void div(value_t *out, const value_t *a, const value_t *b, std::size_t n)
+    { for(std::size_t i = 0; i < n; i++) out[i] = a[i] / b[i]; }
+
+    template<typename value_t>
+    void neg(value_t *out, const value_t *a, std::size_t n)
+    { for(std::size_t i = 0; i < n; i++) out[i] = -a[i]; }
+
+#if defined(__AVX__) || defined(__SSE2__)
+#if defined(__AVX__)
+    typedef __m256d vector_t;
+    const std::size_t width = 4;
+    inline vector_t load(const double *p) { return _mm256_loadu_pd(p); }
+    inline void store(double *p, vector_t v) { _mm256_storeu_pd(p, v); }
+    inline vector_t broadcast(double value) { return _mm256_set1_pd(value); }
+    struct add_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm256_add_pd(a, b); }
+        static double apply(double a, double b) { return a + b; }
+    };
+    struct sub_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm256_sub_pd(a, b); }
+        static double apply(double a, double b) { return a - b; }
+    };
+    struct mul_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm256_mul_pd(a, b); }
+        static double apply(double a, double b) { return a * b; }
+    };
+    struct div_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm256_div_pd(a, b); }
+        static double apply(double a, double b) { return a / b; }
+    };
+#else
+    typedef __m128d vector_t;
+    const std::size_t width = 2;
+    inline vector_t load(const double *p) { return _mm_loadu_pd(p); }
+    inline void store(double *p, vector_t v) { _mm_storeu_pd(p, v); }
+    inline vector_t broadcast(double value) { return _mm_set1_pd(value); }
+    struct add_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm_add_pd(a, b); }
+        static double apply(double a, double b) { return a + b; }
+    };
+    struct sub_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm_sub_pd(a, b); }
+        static double apply(double a, double b) { return a - b; }
+    };
+    struct mul_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm_mul_pd(a, b); }
+        static double apply(double a, double b) { return a * b; }
+    };
+    struct div_op
+    {
+        static vector_t apply(vector_t a, vector_t b)
+        { return _mm_div_pd(a, b); }
+        static double apply(double a, double b) { return a / b; }
+    };
+#endif
+
+    template<typename op_t>
+    void binary(double *out, const double *a, const double *b, std::size_t n)
+    {
+        std::size_t i = 0;
+        for(; i + width <= n; i += width)
+            store(out + i, op_t::apply(load(a + i), load(b + i)));
+        for(; i < n; i++)
+            out[i] = op_t::apply(a[i], b[i]);
+    }
+
+    template<>
+    inline void fill<double>(double *out, double value, std::size_t n)
+    {
+        vector_t v = broadcast(value);
+        std::size_t i = 0;
+        for(; i + width <= n; i += width)
+            store(out + i, v);
+        for(; i < n; i++)
+            out[i] = value;
+    }
+
+    template<>
+    inline void add<double>(double *out, const double *a, const double *b,
+                            std::size_t n)
+    { binary<add_op>(out, a, b, n); }
+
+    template<>
+    inline void sub<double>(double *out, const double *a, const double *b,
+                            std::size_t n)
+    { binary<sub_op>(out, a, b, n); }
+
+    template<>
+    inline void mul<double>(double *out, const double *a, const double *b,
+                            std::size_t n)
+    { binary<mul_op>(out, a, b, n); }
+
+    template<>
+    inline void div<double>(double *out, const double *a, const double *b,
+                            std::size_t n)
+    { binary<div_op>(out, a, b, n); }
+
+    template<>
+    inline void neg<double>(double *out, const double *a, std::size_t n)
+    {
+        vector_t zero = broadcast(0.0);
+        std::size_t i = 0;
+        for(; i + width <= n; i += width)
+            store(out + i, sub_op::apply(zero, load(a + i)));
+        for(; i < n; i++)
+            out[i] = -a[i];
+    }
+#endif
+}
+
+/** Evaluates programs over whole columns of fitness cases
+ *
+ * Instead of running a program once per fitness case, every instruction is
+ * applied to a block of rows at once with the kernels above. Blocks are
+ * small enough for the working stack to stay in the L1 cache. An evaluator
+ * keeps its scratch memory between calls, so it must not be shared between
+ * threads. */
+template<typename value_t>
+class BatchEvaluator
+{
+    public:
+        /// The number of rows evaluated together
+        static const std::size_t block_size = 256;
+
+    private:
+        /// One column of block_size values per stack slot
+        std::vector<value_t> slots;
+        /// The columns on the stack, pointing in slots or in the inputs
+        std::vector<const value_t*> stack;
+        /// Arguments of call instructions
+        std::vector<value_t> arguments;
+
+    public:
+        /** Runs a program on a range of rows
+         * \param program The program to run
+         * \param columns The input columns
+         * \param rows The number of rows in the columns
+         * \param out The output column, of size rows */
+        void run(const Program<value_t> &program,
+                 const value_t * const *columns, std::size_t rows,
+                 value_t *out)
+        {
+            std::size_t depth = program.get_stack_size();
+            if(slots.size() < depth * block_size)
+                slots.resize(depth * block_size);
+            stack.resize(depth);
+            for(std::size_t start = 0; start < rows; start += block_size)
+            {
+                std::size_t n = std::min(block_size, rows - start);
+                unsigned int sp = 0;
+                for(const instruction<value_t> &op : program.get_code())
+                {
+                    value_t *slot;
+                    switch(op.code)
+                    {
+                        case opcode::constant:
+                            slot = &slots[sp * block_size];
+                            kernels::fill(slot, op.value, n);
+                            stack[sp++] = slot;
+                            break;
+                        case opcode::variable:
+                            stack[sp++] = columns[op.index] + start;
+                            break;
+                        case opcode::add:
+                            sp--;
+                            slot = &slots[(sp - 1) * block_size];
+                            kernels::add(slot, stack[sp - 1], stack[sp], n);
+                            stack[sp - 1] = slot;
+                            break;
+                        case opcode::sub:
+                            sp--;
+                            slot = &slots[(sp - 1) * block_size];
+                            kernels::sub(slot, stack[sp - 1], stack[sp], n);
+                            stack[sp - 1] = slot;
+                            break;
+                        case opcode::mul:
+                            sp--;
+                            slot = &slots[(sp - 1) * block_size];
+                            kernels::mul(slot, stack[sp - 1], stack[sp], n);
+                            stack[sp - 1] = slot;
+                            break;
+                        case opcode::div:
+                            sp--;
+                            slot = &slots[(sp - 1) * block_size];
+                            kernels::div(slot, stack[sp - 1], stack[sp], n);
+                            stack[sp - 1] = slot;
+                            break;
+                        case opcode::neg:
+                            slot = &slots[(sp - 1) * block_size];
+                            kernels::neg(slot, stack[sp - 1], n);
+                            stack[sp - 1] = slot;
+                            break;
+                        case opcode::call:
+                            sp -= op.arity;
+                            slot = &slots[sp * block_size];
+                            arguments.resize(op.arity);
+                            for(std::size_t i = 0; i < n; i++)
+                            {
+                                for(unsigned int j = 0; j < op.arity; j++)
+                                    arguments[j] = stack[sp + j][i];
+                                slot[i] = op.function(arguments.data());
+                            }
+                            stack[sp++] = slot;
+                            break;
+                    }
+                }
+                std::copy(stack[0], stack[0] + n, out + start);
+            }
+        }
+
+        /** Runs a program on all the rows of a dataset
+         * \param program The program to run
+         * \param data The fitness cases
+         * \param out Filled with one output per row */
+        void run(const Program<value_t> &program, const Dataset<value_t> &data,
+                 std::vector<value_t> &out)
+        {
+            out.resize(data.rows());
+            std::vector<const value_t*> columns = data.columns();
+            run(program, columns.data(), data.rows(), out.data());
+        }
+};
+
+template<typename value_t>
+const std::size_t BatchEvaluator<value_t>::block_size;
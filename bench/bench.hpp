@@ -0,0 +1,84 @@
+#pragma once
+
+/* Helpers shared by the benchmarks */
+
+#include <chrono>
+
+#include "random.hpp"
+#include "symbolic.hpp"
+
+/** Builds a random expression with a given number of leaves */
+inline tree_ptr<Symbol,math_type> random_expression(Xoshiro256 &gen,
+                                                    unsigned int leaves)
+{
+    if(leaves <= 1)
+    {
+        sym_t type = gen.below(2) ? sym_t::x : sym_t::one;
+        return make_tree<Tree<Symbol,math_type>>(Symbol(type),
+                                                 math_type::number);
+    }
+    unsigned int left = 1 + gen.below(leaves - 1);
+    auto tree = make_tree<Tree<Symbol,math_type>>(Symbol(sym_t::plus),
+                                                  math_type::number);
+    tree->add(random_expression(gen, left));
+    tree->add(random_expression(gen, leaves - left));
+    return tree;
+}
+
+/** Builds a random equation of the symbolic example, with about a given
+ * number of nodes */
+inline tree_ptr<Symbol,math_type> random_equation(Xoshiro256 &gen,
+                                                  unsigned int nodes)
+{
+    unsigned int leaves = nodes / 4 + 1;
+    auto tree = make_tree<Tree<Symbol,math_type>>(Symbol(sym_t::equals),
+                                                  math_type::boolean);
+    tree->add(random_expression(gen, leaves));
+    tree->add(random_expression(gen, leaves));
+    return tree;
+}
+
+/** Converts an expression of the symbolic example to symbolic_set */
+inline symbolic_tree to_symbolic_set(const Tree<Symbol,math_type> &tree)
+{
+    std::vector<symbolic_tree> children;
+    for(auto &child : tree.get_children())
+        children.push_back(to_symbolic_set(*child));
+    switch(tree.get_node().get_type())
+    {
+        case sym_t::x:
+            return symbolic_set::make<VariableX>();
+        case sym_t::plus:
+            return symbolic_set::make<Add>(children);
+        case sym_t::equals:
+            return symbolic_set::make<Equal>(children);
+        default:
+            return symbolic_set::make<ConstantOne>();
+    }
+}
+
+/** Measures the mean duration of an operation
+ *
+ * setup is called before each call to op, outside of the measured time.
+ * \param setup The preparation of each call
+ * \param op The operation to measure
+ * \param min_seconds The minimal measured time
+ * \param calls Set to the number of calls made
+ * \return The mean duration of a call, in nanoseconds */
+template<typename S, typename F>
+double nanoseconds_per_call(S setup, F op, double min_seconds,
+                            unsigned long &calls)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::duration measured = clock::duration::zero();
+    calls = 0;
+    do
+    {
+        setup();
+        auto start = clock::now();
+        op();
+        measured += clock::now() - start;
+        calls++;
+    } while(std::chrono::duration<double>(measured).count() < min_seconds);
+    return std::chrono::duration<double,std::nano>(measured).count() / calls;
+}
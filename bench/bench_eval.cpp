@@ -0,0 +1,81 @@
+/* Compares the throughput of the ways to evaluate a tree on a set of
+ * fitness cases: the recursive evaluate() of the symbolic example, the same
+ * tree over a PrimitiveSet evaluated with inlined primitives, a compiled
+ * Program run once per fitness case, and a BatchEvaluator running the
+ * Program over whole columns. */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "batch.hpp"
+#include "bench.hpp"
+#include "bytecode.hpp"
+#include "symbolic.hpp"
+
+const unsigned int seed = 42;
+const unsigned int rows = 4096;
+const double min_seconds = 0.2;
+
+/** Runs f until min_seconds have elapsed
+ * \return The number of fitness cases evaluated per second */
+template<typename F>
+double samples_per_second(F f)
+{
+    typedef std::chrono::steady_clock clock;
+    unsigned long iterations = 0;
+    auto start = clock::now();
+    double elapsed = 0;
+    do
+    {
+        f();
+        iterations++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < min_seconds);
+    return iterations * rows / elapsed;
+}
+
+int main()
+{
+    Xoshiro256 gen(seed);
+    std::uniform_real_distribution<> dis(-10, 10);
+    Dataset<double> data;
+    data.inputs.resize(1);
+    for(unsigned int i = 0; i < rows; i++)
+        data.inputs[0].push_back(dis(gen));
+
+    std::printf("%-8s %12s %12s %12s %12s %8s\n",
+                "nodes", "recursive", "primitives", "program", "batch",
+                "speedup");
+    for(unsigned int leaves : {8, 32, 128, 512, 2048})
+    {
+        auto tree = random_expression(gen, leaves);
+        symbolic_tree inlined_tree = to_symbolic_set(*tree);
+        Program<double> program = compile<double>(*tree, &encode);
+        BatchEvaluator<double> evaluator;
+        std::vector<double> out(rows);
+        volatile double sink = 0;
+
+        double recursive = samples_per_second([&]() {
+            for(double x : data.inputs[0])
+                sink = sink + evaluate(tree, x);
+        });
+        double inlined = samples_per_second([&]() {
+            for(double x : data.inputs[0])
+                sink = sink + symbolic_set::evaluate(*inlined_tree, &x);
+        });
+        double interpreted = samples_per_second([&]() {
+            for(double x : data.inputs[0])
+                sink = sink + program.run(x);
+        });
+        double batched = samples_per_second([&]() {
+            evaluator.run(program, data, out);
+            sink = sink + out[0];
+        });
+        std::printf("%-8u %12.3g %12.3g %12.3g %12.3g %7.1fx\n",
+                    2 * leaves - 1, recursive, inlined, interpreted, batched,
+                    batched / recursive);
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+/* Benchmarks of the tree operations, of the phases of the optimizer and of
+ * whole runs of the symbolic example.
+ *
+ * Every measurement is printed as one JSON object per line, so that runs
+ * can be compared by scripts. All random numbers come from generators with
+ * fixed seeds and the optimizer runs on a single thread, so two runs
+ * measure the same work. */
+
+#include <cstdio>
+#include <vector>
+
+#include "bench.hpp"
+#include "flat_tree.hpp"
+#include "optimizer.hpp"
+#include "symbolic.hpp"
+#include "tree.hpp"
+
+const unsigned int seed = 42;
+const double min_seconds = 0.1;
+const unsigned int tree_sizes[] = {10, 100, 1000, 10000, 100000};
+const unsigned int population_sizes[] = {50, 100, 200, 500, 1000};
+/// The number of generations of each end-to-end run
+const unsigned int generations = 50;
+
+template<typename optimizer_t>
+struct optimizer_probe
+{
+    static void cross_over(optimizer_t &optimizer)
+    { optimizer._cross_over(optimizer.population); }
+
+    static void natural_selection(optimizer_t &optimizer)
+    {
+        optimizer.natural_selection(optimizer.population, optimizer.scores);
+    }
+
+    static std::vector<typename optimizer_t::individual_t> &
+    population(optimizer_t &optimizer) { return optimizer.population; }
+
+    static std::vector<double> & scores(optimizer_t &optimizer)
+    { return optimizer.scores; }
+};
+
+void print(const char *benchmark, const char *representation,
+           unsigned int nodes, double nanoseconds, unsigned long calls)
+{
+    std::printf("{\"benchmark\":\"%s\",\"tree\":\"%s\",\"nodes\":%u,"
+                "\"ns_per_op\":%.1f,\"ops\":%lu}\n",
+                benchmark, representation, nodes, nanoseconds, calls);
+}
+
+unsigned int size_of(const Tree<Symbol,math_type> &tree)
+{ return tree.get_size(); }
+unsigned int size_of(const FlatTree<Symbol,math_type> &tree)
+{ return tree.size(); }
+
+/** Visitor counting the nodes of a Tree or of a FlatTree */
+struct node_counter
+{
+    volatile unsigned int *count;
+
+    template<typename node_t>
+    void operator()(node_t *, const pos &) const { *count = *count + 1; }
+};
+
+template<typename tree_t>
+std::shared_ptr<tree_t> convert(const tree_ptr<Symbol,math_type> &tree);
+
+template<>
+std::shared_ptr<Tree<Symbol,math_type>> convert(
+        const tree_ptr<Symbol,math_type> &tree)
+{ return tree; }
+
+template<>
+std::shared_ptr<FlatTree<Symbol,math_type>> convert(
+        const tree_ptr<Symbol,math_type> &tree)
+{ return make_tree<FlatTree<Symbol,math_type>>(*tree); }
+
+/** Measures copy, visit, random_position and get_subtree/replace */
+template<typename tree_t>
+void bench_tree_operations(const char *representation, unsigned int nodes)
+{
+    Xoshiro256 gen(seed);
+    auto tree = convert<tree_t>(random_expression(gen, (nodes + 1) / 2));
+    auto donor = convert<tree_t>(random_expression(gen, (nodes + 1) / 2));
+    unsigned int size = size_of(*tree);
+    unsigned long calls;
+    double ns;
+    std::shared_ptr<tree_t> copy;
+
+    ns = nanoseconds_per_call([]() {}, [&]() {
+        copy = make_tree<tree_t>(*tree);
+    }, min_seconds, calls);
+    print("tree.copy", representation, size, ns, calls);
+
+    ns = nanoseconds_per_call([]() {}, [&]() {
+        copy = tree->clone();
+    }, min_seconds, calls);
+    print("tree.clone", representation, size, ns, calls);
+
+    volatile unsigned int visited = 0;
+    ns = nanoseconds_per_call([]() {}, [&]() {
+        tree->visit(node_counter{&visited});
+    }, min_seconds, calls);
+    print("tree.visit", representation, size, ns, calls);
+
+    pos position;
+    ns = nanoseconds_per_call([]() {}, [&]() {
+        position = tree->random_position(gen);
+    }, min_seconds, calls);
+    print("tree.random_position", representation, size, ns, calls);
+
+    std::pair<bool,pos> found;
+    ns = nanoseconds_per_call([]() {}, [&]() {
+        found = tree->random_position(math_type::number, gen);
+    }, min_seconds, calls);
+    print("tree.random_position_typed", representation, size, ns, calls);
+
+    // The tree is copied before each replacement, outside of the measure
+    pos donor_position;
+    ns = nanoseconds_per_call([&]() {
+        copy = make_tree<tree_t>(*tree);
+        do
+            position = copy->random_position(gen);
+        while(position.empty());
+        do
+            donor_position = donor->random_position(gen);
+        while(donor_position.empty());
+    }, [&]() {
+        copy->replace(donor->get_subtree(donor_position), position);
+    }, min_seconds, calls);
+    print("tree.get_subtree_replace", representation, size, ns, calls);
+}
+
+/** Measures the recursive evaluation of the symbolic example */
+void bench_evaluate(unsigned int nodes)
+{
+    Xoshiro256 gen(seed);
+    auto tree = random_expression(gen, (nodes + 1) / 2);
+    unsigned long calls;
+    volatile double sink = 0;
+    double ns = nanoseconds_per_call([]() {}, [&]() {
+        sink = sink + evaluate(tree, 1.5);
+    }, min_seconds, calls);
+    print("tree.evaluate", "Tree", tree->get_size(), ns, calls);
+}
+
+/** Measures one cross over and one natural selection on a population of
+ * trees of a given size */
+void bench_optimizer_phases(unsigned int nodes)
+{
+    typedef Optimizer<Symbol,math_type> optimizer_t;
+    typedef optimizer_probe<optimizer_t> probe;
+    // Large trees get a smaller population to bound the memory used
+    unsigned int population = nodes >= 10000 ? 10 : 100;
+    optimizer_t optimizer(&fitness, [nodes](Xoshiro256 &gen) {
+        return random_equation(gen, nodes);
+    }, population);
+    optimizer.seed(seed);
+    optimizer.initialize();
+    unsigned long calls;
+
+    double ns = nanoseconds_per_call([&]() {
+        // Cross over adds individuals, drop them to keep the size steady
+        if(probe::population(optimizer).size() > population)
+        {
+            probe::population(optimizer).resize(population);
+            probe::scores(optimizer).resize(population);
+        }
+    }, [&]() {
+        probe::cross_over(optimizer);
+    }, min_seconds, calls);
+    print("optimizer.cross_over", "Tree", nodes, ns, calls);
+
+    auto individuals = probe::population(optimizer);
+    auto scores = probe::scores(optimizer);
+    ns = nanoseconds_per_call([&]() {
+        probe::population(optimizer) = individuals;
+        probe::scores(optimizer) = scores;
+    }, [&]() {
+        probe::natural_selection(optimizer);
+    }, min_seconds, calls);
+    print("optimizer.natural_selection", "Tree", nodes, ns, calls);
+}
+
+/** Runs the symbolic example for a fixed number of generations */
+void bench_generations(unsigned int population)
+{
+    typedef std::chrono::steady_clock clock;
+    Optimizer<Symbol,math_type> optimizer(&fitness, [](Xoshiro256 &gen) {
+        return random_equation(gen, 2 + gen.below(30));
+    }, population);
+    optimizer.seed(seed);
+    auto start = clock::now();
+    optimizer.initialize();
+    for(unsigned int i = 0; i < generations; i++)
+        optimizer.next_generation();
+    double seconds = std::chrono::duration<double>(clock::now() - start)
+        .count();
+    std::printf("{\"benchmark\":\"gp.generations\",\"population\":%u,"
+                "\"generations\":%u,\"generations_per_second\":%.2f,"
+                "\"best_fitness\":%.6f}\n",
+                population, generations, generations / seconds,
+                optimizer.best_fitness());
+}
+
+int main()
+{
+    // Whole runs go first, before the large trees below fill the evaluation
+    // cache of the symbolic fitness
+    for(unsigned int population : population_sizes)
+        bench_generations(population);
+    for(unsigned int nodes : tree_sizes)
+    {
+        bench_tree_operations<Tree<Symbol,math_type>>("Tree", nodes);
+        bench_tree_operations<FlatTree<Symbol,math_type>>("FlatTree", nodes);
+        bench_evaluate(nodes);
+        bench_optimizer_phases(nodes);
+    }
+    return 0;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vector>
+
+#include "flat_tree.hpp"
+#include "tree.hpp"
+
+/** The operations of the evaluation stack machine */
+enum class opcode : unsigned char
+{
+    /// Pushes a constant
+    constant,
+    /// Pushes an input variable
+    variable,
+    /// Pops b, a and pushes a + b
+    add,
+    /// Pops b, a and pushes a - b
+    sub,
+    /// Pops b, a and pushes a * b
+    mul,
+    /// Pops b, a and pushes a / b
+    div,
+    /// Pops a and pushes -a
+    neg,
+    /// Pops arity values and pushes function(values)
+    call
+};
+
+/** One instruction of a Program
+ *
+ * Instructions are produced by the encoder given to compile, which maps the
+ * value attached to a node to the operation it stands for. */
+template<typename value_t>
+struct instruction
+{
+    typedef value_t (*function_t)(const value_t *args);
+
+    opcode code;
+    /// The number of operands of a call (set by compile)
+    unsigned int arity;
+    /// The input index of a variable
+    unsigned int index;
+    /// The value of a constant
+    value_t value;
+    /// The function of a call
+    function_t function;
+
+    instruction(opcode code = opcode::constant)
+        : code(code), arity(0), index(0), value(), function(nullptr) {}
+
+    static instruction constant(value_t value)
+    {
+        instruction result(opcode::constant);
+        result.value = value;
+        return result;
+    }
+    static instruction variable(unsigned int index)
+    {
+        instruction result(opcode::variable);
+        result.index = index;
+        return result;
+    }
+    static instruction call(function_t function)
+    {
+        instruction result(opcode::call);
+        result.function = function;
+        return result;
+    }
+};
+
+/** A tree compiled to a postfix instruction stream
+ *
+ * Running a program is a single loop over its instructions, with the
+ * operands kept on a small stack, instead of a recursive walk through the
+ * tree. A program is compiled once and can then be run on any number of
+ * inputs. */
+template<typename value_t>
+class Program
+{
+    private:
+        /// Stack sizes up to this one do not allocate when running
+        static const unsigned int local_stack = 64;
+
+        /// The instructions in postfix order
+        std::vector<instruction<value_t>> code;
+        /// The current depth of the stack, while compiling
+        unsigned int depth = 0;
+        /// The maximal depth of the stack
+        unsigned int stack_size = 0;
+
+    public:
+        /** Appends an instruction to the program
+         * \param op The instruction
+         * \param operands The number of values it pops from the stack */
+        void emit(const instruction<value_t> &op, unsigned int operands)
+        {
+            code.push_back(op);
+            code.back().arity = operands;
+            depth = depth - operands + 1;
+            if(depth > stack_size)
+                stack_size = depth;
+        }
+
+        /** Getter for the instructions */
+        const std::vector<instruction<value_t>> & get_code() const
+        { return code; }
+        /** Getter for the maximal depth of the stack */
+        unsigned int get_stack_size() const { return stack_size; }
+
+        /** Runs the program
+         * \param inputs The values of the variables
+         * \return The value on top of the stack at the end */
+        value_t run(const value_t *inputs) const
+        {
+            value_t local[local_stack];
+            std::vector<value_t> heap;
+            value_t *stack = local;
+            if(stack_size > local_stack)
+            {
+                heap.resize(stack_size);
+                stack = heap.data();
+            }
+            unsigned int sp = 0;
+            for(const instruction<value_t> &op : code)
+            {
+                switch(op.code)
+                {
+                    case opcode::constant:
+                        stack[sp++] = op.value;
+                        break;
+                    case opcode::variable:
+                        stack[sp++] = inputs[op.index];
+                        break;
+                    case opcode::add:
+                        sp--;
+                        stack[sp - 1] = stack[sp - 1] + stack[sp];
+                        break;
+                    case opcode::sub:
+                        sp--;
+                        stack[sp - 1] = stack[sp - 1] - stack[sp];
+                        break;
+                    case opcode::mul:
+                        sp--;
+                        stack[sp - 1] = stack[sp - 1] * stack[sp];
+                        break;
+                    case opcode::div:
+                        sp--;
+                        stack[sp - 1] = stack[sp - 1] / stack[sp];
+                        break;
+                    case opcode::neg:
+                        stack[sp - 1] = -stack[sp - 1];
+                        break;
+                    case opcode::call:
+                        sp -= op.arity;
+                        stack[sp] = op.function(stack + sp);
+                        sp++;
+                        break;
+                }
+            }
+            return sp ? stack[sp - 1] : value_t();
+        }
+
+        /** Runs the program with a single input variable */
+        value_t run(value_t input) const { return run(&input); }
+};
+
+/** Emits the instruction of a node whose children have been compiled
+ * \param program The program being compiled
+ * \param op The instruction of the node
+ * \param children The number of children of the node
+ *
+ * add and mul nodes can have any number of children, they are compiled to
+ * a chain of binary operations. Without children they push their identity,
+ * 0 or 1, and with one child they leave its value on the stack. */
+template<typename value_t>
+void emit_node(Program<value_t> &program, const instruction<value_t> &op,
+               unsigned int children)
+{
+    if(op.code == opcode::add || op.code == opcode::mul)
+    {
+        if(children == 0)
+            program.emit(instruction<value_t>::constant(
+                        op.code == opcode::add ? value_t(0) : value_t(1)), 0);
+        for(unsigned int i = 1; i < children; i++)
+            program.emit(op, 2);
+    }
+    else
+    {
+        program.emit(op, children);
+    }
+}
+
+template<typename value_t, typename T, typename node_type_t,
+         typename encoder_t>
+void compile(Program<value_t> &program, const Tree<T,node_type_t> &tree,
+             encoder_t &encode)
+{
+    for(auto &child : tree.get_children())
+        compile(program, *child, encode);
+    emit_node(program, encode(tree.get_node()), tree.get_children().size());
+}
+
+/** Compiles a tree to a Program
+ * \param tree The tree to compile
+ * \param encode A function returning the instruction<value_t> of the value
+ * of type T attached to a node
+ * \return The compiled program */
+template<typename value_t, typename T, typename node_type_t,
+         typename encoder_t>
+Program<value_t> compile(const Tree<T,node_type_t> &tree, encoder_t encode)
+{
+    Program<value_t> program;
+    compile(program, tree, encode);
+    return program;
+}
+
+template<typename value_t, typename T, typename node_type_t,
+         typename encoder_t>
+unsigned int compile(Program<value_t> &program,
+                     const FlatTree<T,node_type_t> &tree,
+                     unsigned int index, encoder_t &encode)
+{
+    auto &nodes = tree.get_nodes();
+    unsigned int end = index + nodes[index].size;
+    unsigned int child = index + 1;
+    unsigned int children = 0;
+    while(child < end)
+    {
+        child = compile(program, tree, child, encode);
+        children++;
+    }
+    emit_node(program, encode(nodes[index].value), children);
+    return end;
+}
+
+/** Compiles a FlatTree to a Program
+ * \param tree The tree to compile
+ * \param encode A function returning the instruction<value_t> of the value
+ * of type T attached to a node
+ * \return The compiled program */
+template<typename value_t, typename T, typename node_type_t,
+         typename encoder_t>
+Program<value_t> compile(const FlatTree<T,node_type_t> &tree,
+                         encoder_t encode)
+{
+    Program<value_t> program;
+    compile(program, tree, 0, encode);
+    return program;
+}
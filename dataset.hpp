@@ -0,0 +1,430 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "serialize.hpp"
+
+/** Fitness cases stored in a columnar binary file, mapped in memory
+ *
+ * The file holds a header, then each input column and the target column
+ * one after the other, each as rows contiguous values of type value_t.
+ * Nothing is read up front: pages are loaded by the kernel as evaluators
+ * touch them and can be evicted again under memory pressure, so datasets
+ * larger than the memory can be used. Values are stored in the byte order
+ * of the machine that wrote the file (see write_dataset and convert_csv).
+ *
+ * A mapped dataset is only read, so it can be shared between threads. */
+template<typename value_t>
+class MappedDataset
+{
+    public:
+        /// Identifies dataset files, followed by the format version
+        static const std::uint64_t magic = 0x5453544144504743ULL;
+        static const std::uint32_t version = 1;
+
+        /// The layout of the start of a dataset file
+        struct header
+        {
+            std::uint64_t magic;
+            std::uint32_t version;
+            /// sizeof(value_t)
+            std::uint32_t value_size;
+            /// The number of input columns
+            std::uint32_t inputs;
+            std::uint32_t padding;
+            std::uint64_t rows;
+        };
+
+    private:
+        MappedFile file;
+        std::size_t input_count;
+        std::size_t row_count;
+        const value_t *first;
+
+    public:
+        /** Maps a dataset file
+         * \param path The path of the file
+         * \throw std::runtime_error If the file cannot be mapped or is not a
+         * dataset of value_t */
+        explicit MappedDataset(const std::string &path)
+            // Read again at every evaluation and column by column, so
+            // pages read must stay cached
+            : file(path, MADV_NORMAL)
+        {
+            header h;
+            if(file.size() < sizeof(h))
+                throw std::runtime_error(path + " is not a dataset");
+            std::memcpy(&h, file.begin(), sizeof(h));
+            if(h.magic != magic || h.version != version
+               || h.value_size != sizeof(value_t)
+               || (file.size() - sizeof(h)) / sizeof(value_t)
+                  / ((std::uint64_t)h.inputs + 1)
+                  < h.rows)
+                throw std::runtime_error(path + " is not a dataset of this "
+                                         "value type");
+            input_count = h.inputs;
+            row_count = h.rows;
+            first = reinterpret_cast<const value_t*>(file.begin()
+                                                     + sizeof(h));
+        }
+
+        /** Getter for the number of fitness cases */
+        std::size_t rows() const { return row_count; }
+
+        /** Getter for the number of input variables */
+        std::size_t inputs() const { return input_count; }
+
+        /** Getter for an input column, of size rows */
+        const value_t * column(std::size_t index) const
+        { return first + index * row_count; }
+
+        /** Getter for pointers to the input columns */
+        std::vector<const value_t*> columns() const
+        {
+            std::vector<const value_t*> result;
+            for(std::size_t i = 0; i < input_count; i++)
+                result.push_back(column(i));
+            return result;
+        }
+
+        /** Getter for the target column, of size rows */
+        const value_t * targets() const { return column(input_count); }
+
+        /** Asks the kernel to start reading a range of rows of every
+         * column, without waiting for it
+         * \param start The first row
+         * \param count The number of rows */
+        void prefetch(std::size_t start, std::size_t count) const
+        {
+            if(start >= row_count)
+                return;
+            count = std::min(count, row_count - start);
+            std::size_t page = ::sysconf(_SC_PAGESIZE);
+            for(std::size_t i = 0; i <= input_count; i++)
+            {
+                std::uintptr_t begin =
+                    reinterpret_cast<std::uintptr_t>(column(i) + start);
+                std::uintptr_t end = begin + count * sizeof(value_t);
+                begin -= begin % page;
+                ::madvise(reinterpret_cast<void*>(begin), end - begin,
+                          MADV_WILLNEED);
+            }
+        }
+};
+
+template<typename value_t>
+const std::uint64_t MappedDataset<value_t>::magic;
+template<typename value_t>
+const std::uint32_t MappedDataset<value_t>::version;
+
+/** Writes an in-memory Dataset to a file that MappedDataset can map
+ * \param path The path of the file
+ * \param data The fitness cases, targets must have one value per row
+ * \throw std::invalid_argument If there is not one target per row
+ * \throw std::runtime_error If the file cannot be written */
+template<typename value_t>
+void write_dataset(const std::string &path, const Dataset<value_t> &data)
+{
+    typename MappedDataset<value_t>::header h;
+    h.magic = MappedDataset<value_t>::magic;
+    h.version = MappedDataset<value_t>::version;
+    h.value_size = sizeof(value_t);
+    h.inputs = data.inputs.size();
+    h.padding = 0;
+    h.rows = data.rows();
+    if(data.targets.size() != h.rows)
+        throw std::invalid_argument("a dataset needs one target per row");
+    std::vector<char> buffer;
+    serial_append(buffer, h);
+    for(const std::vector<value_t> &column : data.inputs)
+        for(const value_t &value : column)
+            serial_append(buffer, value);
+    for(const value_t &value : data.targets)
+        serial_append(buffer, value);
+    write_file_atomically(path, buffer);
+}
+
+/** Converts a CSV file of numbers to a file that MappedDataset can map
+ *
+ * Each line is a fitness case, the last field is the target and the other
+ * ones the inputs. A first line that does not start with a number is
+ * skipped as a header. The conversion reads the CSV file twice and only
+ * keeps a few thousand values per column in memory, so it works on files
+ * larger than the memory.
+ * \param csv_path The path of the CSV file
+ * \param path The path of the dataset file
+ * \throw std::runtime_error If a file cannot be read or written, or a line
+ * does not have the same number of fields as the first one */
+template<typename value_t>
+void convert_csv(const std::string &csv_path, const std::string &path)
+{
+    typedef typename MappedDataset<value_t>::header header_t;
+    // Values are written by columns while rows are read, through one
+    // buffer per column
+    const std::size_t buffered_values = 4096;
+
+    std::ifstream csv(csv_path);
+    if(!csv)
+        throw std::runtime_error("cannot open " + csv_path);
+    std::string line;
+    std::vector<value_t> fields;
+    auto parse = [&](unsigned long line_number) -> bool {
+        fields.clear();
+        const char *p = line.c_str();
+        while(true)
+        {
+            char *end;
+            double value = std::strtod(p, &end);
+            if(end == p)
+                return false;
+            fields.push_back(static_cast<value_t>(value));
+            while(*end == ' ' || *end == '\t' || *end == '\r')
+                end++;
+            if(*end == '\0')
+                return true;
+            if(*end != ',')
+                throw std::runtime_error(csv_path + ":"
+                        + std::to_string(line_number) + ": not a number");
+            p = end + 1;
+        }
+    };
+    auto blank = [&]() {
+        return line.find_first_not_of(" \t\r") == std::string::npos;
+    };
+
+    // First pass: count the rows and the columns
+    std::size_t columns = 0;
+    std::uint64_t rows = 0;
+    bool has_header = false;
+    unsigned long line_number = 0;
+    while(std::getline(csv, line))
+    {
+        line_number++;
+        if(blank())
+            continue;
+        bool numbers = parse(line_number);
+        if(!numbers && line_number == 1)
+        {
+            has_header = true;
+            continue;
+        }
+        if(!numbers || (columns && fields.size() != columns))
+            throw std::runtime_error(csv_path + ":"
+                    + std::to_string(line_number)
+                    + ": wrong number of fields");
+        columns = fields.size();
+        rows++;
+    }
+    if(columns == 0)
+        throw std::runtime_error(csv_path + " has no fitness case");
+
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw std::runtime_error("cannot create " + temporary + ": "
+                                 + std::strerror(errno));
+    auto write_at = [&](const void *data, std::size_t size, off_t offset) {
+        const char *bytes = static_cast<const char*>(data);
+        while(size > 0)
+        {
+            ssize_t written = ::pwrite(fd, bytes, size, offset);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written < 0)
+            {
+                int error = errno;
+                ::close(fd);
+                throw std::runtime_error("cannot write " + temporary + ": "
+                                         + std::strerror(error));
+            }
+            bytes += written;
+            size -= written;
+            offset += written;
+        }
+    };
+
+    header_t h;
+    h.magic = MappedDataset<value_t>::magic;
+    h.version = MappedDataset<value_t>::version;
+    h.value_size = sizeof(value_t);
+    h.inputs = columns - 1;
+    h.padding = 0;
+    h.rows = rows;
+    write_at(&h, sizeof(h), 0);
+
+    // Second pass: write the values of each column at their place
+    std::vector<std::vector<value_t>> buffers(columns);
+    std::uint64_t flushed = 0;
+    auto flush = [&]() {
+        for(std::size_t c = 0; c < columns; c++)
+        {
+            write_at(buffers[c].data(), buffers[c].size() * sizeof(value_t),
+                     sizeof(h) + (c * rows + flushed) * sizeof(value_t));
+            buffers[c].clear();
+        }
+    };
+    csv.clear();
+    csv.seekg(0);
+    line_number = 0;
+    while(std::getline(csv, line))
+    {
+        line_number++;
+        if(blank() || (has_header && line_number == 1))
+            continue;
+        parse(line_number);
+        for(std::size_t c = 0; c < columns; c++)
+            buffers[c].push_back(fields[c]);
+        if(buffers[0].size() == buffered_values)
+        {
+            flush();
+            flushed += buffered_values;
+        }
+    }
+    flush();
+    bool synced = ::fsync(fd) == 0;
+    if(::close(fd) != 0 || !synced)
+        throw std::runtime_error("cannot write " + temporary + ": "
+                                 + std::strerror(errno));
+    if(std::rename(temporary.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("cannot rename " + temporary + ": "
+                                 + std::strerror(errno));
+}
+
+/** What the optimizer asks of the evaluation of one individual, to let a
+ * fitness function skip work (see Optimizer::set_partial_fitness)
+ *
+ * The fitness cases are split in blocks, and only the blocks whose index
+ * is phase modulo stride are used. The evaluation may also stop as soon as
+ * the score is known to be lower than threshold, and return an upper bound
+ * of the score lower than threshold. */
+struct evaluation_request
+{
+    double threshold = -std::numeric_limits<double>::infinity();
+    unsigned int stride = 1;
+    unsigned int phase = 0;
+
+    /** Whether the score must be computed on every fitness case */
+    bool complete() const { return stride <= 1; }
+};
+
+/** Fitness function of symbolic regression over a MappedDataset
+ *
+ * A tree is compiled to a Program (see compile) and run by a
+ * BatchEvaluator over chunks of rows small enough for the inputs and the
+ * outputs of a chunk to stay in the L2 cache. While a chunk is evaluated,
+ * the kernel is asked to read the rows that follow, so that reading the
+ * file overlaps with the evaluation.
+ *
+ * The fitness is 1 / (1 + mean absolute error), 0 if an output is not a
+ * number. Calls can be made from several threads at once.
+ *
+ * Partial evaluations (see evaluation_request) interleave blocks of
+ * BatchEvaluator::block_size rows. Since errors are not negative, the
+ * error accumulated so far bounds the fitness from above, which is checked
+ * against the threshold after each chunk. */
+template<typename value_t, typename encoder_t>
+class DatasetFitness
+{
+    private:
+        std::shared_ptr<const MappedDataset<value_t>> data;
+        encoder_t encode;
+        /// The number of rows evaluated together
+        std::size_t chunk_rows;
+        /// The number of rows prefetched at once
+        std::size_t prefetch_rows;
+
+    public:
+        /** Constructor for DatasetFitness
+         * \param data The fitness cases
+         * \param encode A function returning the instruction<value_t> of
+         * the value attached to a node (see compile)
+         * \param cache_bytes The size of the cache chunks should fit in */
+        DatasetFitness(std::shared_ptr<const MappedDataset<value_t>> data,
+                       encoder_t encode, std::size_t cache_bytes = 256 << 10)
+            : data(data), encode(encode)
+        {
+            std::size_t block = BatchEvaluator<value_t>::block_size;
+            // The inputs, the targets and the outputs of a chunk
+            std::size_t row_bytes = (data->inputs() + 2) * sizeof(value_t);
+            chunk_rows = std::max(block, cache_bytes / row_bytes / block * block);
+            prefetch_rows = 16 * chunk_rows;
+        }
+
+        template<typename individual_t>
+        double operator()(const individual_t &tree) const
+        { return (*this)(tree, evaluation_request()); }
+
+        template<typename individual_t>
+        double operator()(const individual_t &tree,
+                          const evaluation_request &request) const
+        {
+            static thread_local BatchEvaluator<value_t> evaluator;
+            static thread_local std::vector<value_t> outputs;
+            static thread_local std::vector<const value_t*> columns;
+
+            std::size_t rows = data->rows();
+            // The rows are evaluated unit by unit, one unit out of stride
+            std::size_t unit = chunk_rows;
+            std::size_t stride = 1;
+            std::size_t first = 0;
+            if(!request.complete())
+            {
+                unit = BatchEvaluator<value_t>::block_size;
+                stride = request.stride;
+                first = request.phase % stride;
+            }
+            std::size_t used = 0;
+            for(std::size_t start = first * unit; start < rows;
+                start += stride * unit)
+                used += std::min(unit, rows - start);
+            if(used == 0)
+                return 1;
+            // The evaluation stops once error exceeds this limit
+            double limit = std::numeric_limits<double>::infinity();
+            if(request.threshold > 0)
+                limit = used * (1 / request.threshold - 1);
+
+            Program<value_t> program = compile<value_t>(*tree, encode);
+            outputs.resize(unit);
+            columns.resize(data->inputs());
+            double error = 0;
+            if(stride == 1)
+                data->prefetch(0, prefetch_rows);
+            for(std::size_t start = first * unit; start < rows;
+                start += stride * unit)
+            {
+                if(stride == 1 && start % prefetch_rows == 0)
+                    data->prefetch(start + prefetch_rows, prefetch_rows);
+                std::size_t n = std::min(unit, rows - start);
+                for(std::size_t i = 0; i < columns.size(); i++)
+                    columns[i] = data->column(i) + start;
+                evaluator.run(program, columns.data(), n, outputs.data());
+                const value_t *targets = data->targets() + start;
+                for(std::size_t i = 0; i < n; i++)
+                    error += std::abs((double)(outputs[i] - targets[i]));
+                if(error > limit)
+                    return 1 / (1 + error / used);
+            }
+            if(!std::isfinite(error))
+                return 0;
+            return 1 / (1 + error / used);
+        }
+};
@@ -0,0 +1,570 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "island.hpp"
+#include "optimizer.hpp"
+#include "random.hpp"
+#include "serialize.hpp"
+#include "transport.hpp"
+
+/** The kinds of messages of a distributed run */
+enum class island_message : std::uint32_t
+{
+    /// Individuals sent by a worker to another one
+    migrants,
+    /// The best individual of a worker, sent to the coordinator
+    report,
+    /// Asks a worker to stop
+    stop,
+    /// The last report of a worker, which has stopped
+    done
+};
+
+/** A decoded message of a distributed run */
+template<typename individual_t>
+struct island_envelope
+{
+    island_message kind;
+    /// The endpoint of the sender
+    unsigned int source;
+    /// The generation of the sender
+    unsigned int generation;
+    /// The individuals and their scores
+    std::vector<std::pair<individual_t,double>> individuals;
+};
+
+const std::uint32_t island_message_magic = 0x4d4d5047; // "GPMM"
+
+/** Encodes a message in the binary tree format of checkpoints
+ *
+ * A message is a header (magic, kind, source, generation, count) followed
+ * by the score and the binary form (see write_tree) of each individual.
+ * \param buffer Replaced by the message */
+template<typename individual_t>
+void encode_message(std::vector<char> &buffer, island_message kind,
+        unsigned int source, unsigned int generation,
+        const std::vector<std::pair<individual_t,double>> &individuals = {})
+{
+    buffer.clear();
+    serial_append(buffer, island_message_magic);
+    serial_append(buffer, (std::uint32_t)kind);
+    serial_append(buffer, (std::uint32_t)source);
+    serial_append(buffer, (std::uint32_t)generation);
+    serial_append(buffer, (std::uint32_t)individuals.size());
+    for(const auto &individual : individuals)
+    {
+        serial_append(buffer, individual.second);
+        write_tree(buffer, *individual.first);
+    }
+}
+
+/** Decodes a message written by encode_message, in the current arena
+ * \throw std::runtime_error If the message is malformed */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t>
+island_envelope<std::shared_ptr<tree_t<T,node_type_t>>> decode_message(
+        const std::vector<char> &buffer)
+{
+    const char *in = buffer.data();
+    const char *end = in + buffer.size();
+    if(serial_extract<std::uint32_t>(in, end) != island_message_magic)
+        throw std::runtime_error("not a message of a distributed run");
+    island_envelope<std::shared_ptr<tree_t<T,node_type_t>>> message;
+    std::uint32_t kind = serial_extract<std::uint32_t>(in, end);
+    if(kind > (std::uint32_t)island_message::done)
+        throw std::runtime_error("unknown message of a distributed run");
+    message.kind = (island_message)kind;
+    message.source = serial_extract<std::uint32_t>(in, end);
+    message.generation = serial_extract<std::uint32_t>(in, end);
+    std::uint32_t count = serial_extract<std::uint32_t>(in, end);
+    for(std::uint32_t i = 0; i < count; i++)
+    {
+        double score = serial_extract<double>(in, end);
+        message.individuals.push_back(std::make_pair(
+                    read_tree<T,node_type_t,tree_t>(in, end), score));
+    }
+    return message;
+}
+
+/** Getter for the processors of a NUMA node, as listed by Linux
+ * \param node The number of the node
+ * \return The numbers of its processors
+ * \throw std::runtime_error If the node does not exist */
+inline std::vector<unsigned int> numa_node_cpus(unsigned int node)
+{
+    std::string path = "/sys/devices/system/node/node"
+        + std::to_string(node) + "/cpulist";
+    std::ifstream file(path);
+    std::string list;
+    if(!std::getline(file, list))
+        throw std::runtime_error("cannot read " + path);
+    // A list of ranges, such as 0-3,8-11
+    std::vector<unsigned int> cpus;
+    std::istringstream ranges(list);
+    std::string range;
+    while(std::getline(ranges, range, ','))
+    {
+        if(range.empty())
+            continue;
+        std::size_t dash = range.find('-');
+        unsigned int first = std::stoul(range.substr(0, dash));
+        unsigned int last = dash == std::string::npos ? first
+            : std::stoul(range.substr(dash + 1));
+        for(unsigned int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+/** Getter for the number of NUMA nodes, numbered from 0, as listed by
+ * Linux
+ * \return The number of nodes, 0 if Linux does not list them */
+inline unsigned int numa_node_count()
+{
+    unsigned int count = 0;
+    while(std::ifstream("/sys/devices/system/node/node"
+                        + std::to_string(count) + "/cpulist"))
+        count++;
+    return count;
+}
+
+/** Restricts the calling thread to a set of processors
+ *
+ * Threads started afterwards, such as the scoring threads of an Optimizer
+ * (see Optimizer::set_threads), inherit the restriction, and the memory
+ * they first touch is allocated on the node of these processors. Pin a
+ * worker before configuring its optimizer.
+ * \param cpus The numbers of the processors
+ * \throw std::runtime_error If the restriction cannot be applied */
+inline void pin_to_cpus(const std::vector<unsigned int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int cpu : cpus)
+        if(cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    if(::sched_setaffinity(0, sizeof(set), &set) != 0)
+        throw std::runtime_error(std::string("cannot set CPU affinity: ")
+                                 + std::strerror(errno));
+}
+
+/** Starts worker processes
+ *
+ * Each child runs worker with its index and exits with the returned
+ * status, or 1 if worker throws, after printing the exception to
+ * std::cerr. Fork before starting any thread, such as the scoring threads
+ * of an optimizer: only the forking thread exists in the children.
+ * \param count The number of workers
+ * \param worker The function run by each child
+ * \return The process ids of the children
+ * \throw std::runtime_error If a process cannot be started */
+inline std::vector<pid_t> fork_workers(unsigned int count,
+        std::function<int(unsigned int)> worker)
+{
+    std::vector<pid_t> children;
+    // Output buffered by the parent would be written again by the children
+    std::cout.flush();
+    for(unsigned int i = 0; i < count; i++)
+    {
+        pid_t pid = ::fork();
+        if(pid < 0)
+            throw std::runtime_error(std::string("cannot fork: ")
+                                     + std::strerror(errno));
+        if(pid == 0)
+        {
+            int status = 1;
+            try
+            {
+                status = worker(i);
+            }
+            catch(const std::exception &e)
+            {
+                std::cerr << "worker " << i << ": " << e.what() << std::endl;
+            }
+            catch(...)
+            {
+                std::cerr << "worker " << i << ": unknown exception"
+                          << std::endl;
+            }
+            // Skips the destructors and exit handlers of the parent's
+            // objects, which the parent runs itself
+            ::_exit(status);
+        }
+        children.push_back(pid);
+    }
+    return children;
+}
+
+/** Makes a liveness check of worker processes, for
+ * IslandCoordinator::set_liveness
+ *
+ * Exited children are not reaped, so wait_workers still gets their status.
+ * \param children The process ids returned by fork_workers
+ * \return A function telling whether the process of a worker is running */
+inline std::function<bool(unsigned int)> process_liveness(
+        const std::vector<pid_t> &children)
+{
+    return [children](unsigned int worker) {
+        if(worker >= children.size())
+            return false;
+        siginfo_t info;
+        info.si_pid = 0;
+        if(::waitid(P_PID, children[worker], &info,
+                    WEXITED | WNOHANG | WNOWAIT) != 0)
+            return errno == EINTR;
+        return info.si_pid == 0;
+    };
+}
+
+/** Waits for worker processes
+ * \param children The process ids returned by fork_workers
+ * \return Whether all of them exited with status 0 */
+inline bool wait_workers(const std::vector<pid_t> &children)
+{
+    bool success = true;
+    for(pid_t pid : children)
+    {
+        int status;
+        while(::waitpid(pid, &status, 0) < 0)
+            if(errno != EINTR)
+                return false;
+        success = success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    return success;
+}
+
+/** One island of a distributed run, evolving an Optimizer in its own
+ * process
+ *
+ * Workers are numbered 0 to workers - 1, which are also their endpoints in
+ * the transport. The coordinator (see IslandCoordinator) is endpoint
+ * workers. Every interval generations, a worker sends copies of its best
+ * individuals to other workers, in the binary form of checkpoints, inserts
+ * the migrants it has received and reports its best individual to the
+ * coordinator. It stops when it reaches the target fitness, the maximal
+ * number of generations, or when the coordinator asks it to.
+ *
+ * Seed each worker differently, for example with
+ * Xoshiro256(seed).stream(rank).get_seed() as IslandOptimizer does. */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t = Tree,
+         typename fitness_t
+             = std::function<double(tree_ptr<T,node_type_t,tree_t>)>>
+class IslandWorker
+{
+    public:
+        typedef Optimizer<T,node_type_t,tree_t,fitness_t> optimizer_t;
+        typedef typename optimizer_t::individual_t individual_t;
+        typedef std::pair<individual_t,double> migrant_t;
+
+    private:
+        optimizer_t &optimizer;
+        std::shared_ptr<MigrationTransport> transport;
+        const unsigned int rank;
+        const unsigned int workers;
+        migration_topology topology;
+        /// The number of generations between migrations
+        const unsigned int interval;
+        /// The number of individuals sent at each migration
+        const unsigned int migrants;
+        /// The number of tries of the final report, one per millisecond
+        const unsigned int final_tries = 5000;
+        bool stopping = false;
+        std::vector<char> buffer;
+
+        std::vector<unsigned int> destinations(Xoshiro256 &gen) const
+        {
+            std::vector<unsigned int> result;
+            if(workers < 2)
+                return result;
+            switch(topology)
+            {
+                case migration_topology::ring:
+                    result.push_back((rank + 1) % workers);
+                    break;
+                case migration_topology::fully_connected:
+                    for(unsigned int i = 0; i < workers; i++)
+                        if(i != rank)
+                            result.push_back(i);
+                    break;
+                case migration_topology::random:
+                    result.push_back((rank + 1 + gen.below(workers - 1))
+                                     % workers);
+                    break;
+            }
+            return result;
+        }
+
+        /** Sends the best individuals to the destinations and the best
+         * one to the coordinator */
+        void migrate(Xoshiro256 &gen)
+        {
+            std::vector<migrant_t> elite = optimizer.elite(migrants);
+            encode_message(buffer, island_message::migrants, rank,
+                           optimizer.get_generation(), elite);
+            for(unsigned int to : destinations(gen))
+                transport->send(to, buffer);
+            report(island_message::report);
+        }
+
+        bool report(island_message kind, bool with_best = true)
+        {
+            std::vector<migrant_t> best;
+            if(with_best)
+                best.push_back(std::make_pair(optimizer.best(),
+                                              optimizer.best_fitness()));
+            encode_message(buffer, kind, rank, optimizer.get_generation(),
+                           best);
+            return transport->send(workers, buffer);
+        }
+
+        /** Sends the last report, retrying while the queue of the
+         * coordinator is full */
+        void finish(bool with_best)
+        {
+            for(unsigned int i = 0; i < final_tries; i++)
+            {
+                if(report(island_message::done, with_best))
+                    return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        /** Handles the messages waiting for this worker */
+        void receive()
+        {
+            std::vector<migrant_t> received;
+            while(transport->receive(rank, buffer))
+            {
+                auto message = decode_message<T,node_type_t,tree_t>(buffer);
+                if(message.kind == island_message::stop)
+                    stopping = true;
+                else if(message.kind == island_message::migrants)
+                    received.insert(received.end(),
+                                    message.individuals.begin(),
+                                    message.individuals.end());
+            }
+            if(!received.empty() && !stopping)
+                optimizer.immigrate(received);
+        }
+
+    public:
+        /** Constructor for IslandWorker
+         * \param optimizer The optimizer of this island, which must
+         * outlive the worker
+         * \param transport The transport shared by the run
+         * \param rank The number of this worker
+         * \param workers The number of workers
+         * \param topology Where this worker sends its migrants
+         * \param interval The number of generations between migrations
+         * \param migrants The number of individuals sent at each
+         * migration */
+        IslandWorker(optimizer_t &optimizer,
+                     std::shared_ptr<MigrationTransport> transport,
+                     unsigned int rank, unsigned int workers,
+                     migration_topology topology = migration_topology::ring,
+                     unsigned int interval = 10, unsigned int migrants = 2)
+            : optimizer(optimizer), transport(transport), rank(rank),
+            workers(workers), topology(topology),
+            interval(interval ? interval : 1), migrants(migrants)
+        {}
+
+        /** Evolves the island until the target fitness is reached, here or
+         * on another worker
+         *
+         * The last report is retried for a few seconds if the queue of the
+         * coordinator is full. It is also sent, without individual, if the
+         * optimizer throws, so that the coordinator does not wait for this
+         * worker.
+         * \param target_fitness The score at which the run stops
+         * \param max_generations The maximal number of generations
+         * \return The best individual of this island */
+        individual_t run(double target_fitness,
+                unsigned int max_generations
+                    = std::numeric_limits<unsigned int>::max())
+        {
+            // Far from the streams the optimizer uses for its generations
+            Xoshiro256 gen = Xoshiro256(optimizer.get_seed()).stream(
+                    std::numeric_limits<std::uint64_t>::max());
+            stopping = false;
+            try
+            {
+                optimizer.initialize();
+                for(unsigned int i = 0; i < max_generations; i++)
+                {
+                    receive();
+                    if(stopping || optimizer.best_fitness() >= target_fitness)
+                        break;
+                    optimizer.next_generation();
+                    if((i + 1) % interval == 0)
+                        migrate(gen);
+                }
+            }
+            catch(...)
+            {
+                finish(false);
+                throw;
+            }
+            finish(true);
+            return optimizer.best();
+        }
+};
+
+/** The coordinator of a distributed run (see IslandWorker)
+ *
+ * It keeps the best individual reported by the workers and, once it
+ * reaches the target fitness, asks every worker to stop. */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t = Tree>
+class IslandCoordinator
+{
+    public:
+        typedef std::shared_ptr<tree_t<T,node_type_t>> individual_t;
+
+    private:
+        std::shared_ptr<MigrationTransport> transport;
+        const unsigned int workers;
+        individual_t best;
+        double best_fitness = -std::numeric_limits<double>::infinity();
+        std::vector<char> buffer;
+        /// Tells whether a worker is still running, if set
+        std::function<bool(unsigned int)> alive;
+        /// Whether every worker sent its last report in the last run
+        bool complete = false;
+
+        void send_stop(const std::vector<bool> &done)
+        {
+            encode_message<individual_t>(buffer, island_message::stop,
+                                         workers, 0);
+            for(unsigned int i = 0; i < workers; i++)
+                if(!done[i])
+                    transport->send(i, buffer);
+        }
+
+    public:
+        /** Constructor for IslandCoordinator
+         * \param transport The transport shared by the run
+         * \param workers The number of workers, the coordinator being
+         * endpoint workers */
+        IslandCoordinator(std::shared_ptr<MigrationTransport> transport,
+                          unsigned int workers)
+            : transport(transport), workers(workers)
+        {}
+
+        /** Sets the liveness check of the workers, so that a worker that
+         * stops without its last report, for example killed, does not make
+         * run wait forever
+         * \param check A function telling whether a worker is running, such
+         * as process_liveness(children) */
+        void set_liveness(std::function<bool(unsigned int)> check)
+        { alive = check; }
+
+        /** Collects the reports of the workers until all of them are done
+         *
+         * A worker is done once it sent its last report, or once the
+         * liveness check (see set_liveness) found it stopped and its
+         * messages were all received.
+         * \param target_fitness The score at which the workers are stopped
+         * \param timeout The maximal duration of the run in seconds, 0 for
+         * no limit. Workers still running are then asked to stop.
+         * \return The best individual reported, nullptr if none */
+        individual_t run(double target_fitness, double timeout = 0)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<bool> done(workers, false);
+            // The workers found stopped before the last receive
+            std::vector<bool> stopped(workers, false);
+            unsigned int remaining = workers;
+            bool stopping = false;
+            complete = false;
+            while(remaining > 0)
+            {
+                if(!transport->receive(workers, buffer))
+                {
+                    // A worker found stopped before a receive that finds
+                    // no message has no message left
+                    for(unsigned int i = 0; alive && i < workers; i++)
+                    {
+                        if(done[i])
+                            continue;
+                        if(stopped[i])
+                        {
+                            done[i] = true;
+                            remaining--;
+                        }
+                        else
+                            stopped[i] = !alive(i);
+                    }
+                    if(remaining == 0)
+                        return best;
+                    if(timeout > 0 && std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                            .count() >= timeout)
+                    {
+                        send_stop(done);
+                        return best;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    continue;
+                }
+                auto message = decode_message<T,node_type_t,tree_t>(buffer);
+                if(message.source >= workers)
+                    continue;
+                for(auto &individual : message.individuals)
+                {
+                    if(individual.second > best_fitness)
+                    {
+                        best = individual.first;
+                        best_fitness = individual.second;
+                    }
+                }
+                if(message.kind == island_message::done)
+                {
+                    if(!done[message.source])
+                        remaining--;
+                    done[message.source] = true;
+                }
+                if(best_fitness >= target_fitness && !stopping)
+                {
+                    stopping = true;
+                    send_stop(done);
+                }
+                else if(stopping && message.kind == island_message::report)
+                {
+                    // The stop message was lost or crossed this report
+                    encode_message<individual_t>(buffer, island_message::stop,
+                                                 workers, 0);
+                    transport->send(message.source, buffer);
+                }
+            }
+            complete = true;
+            return best;
+        }
+
+        /** Getter for whether every worker sent its last report during the
+         * last run, rather than stopping early or being timed out */
+        bool is_complete() const { return complete; }
+
+        /** Getter for the best score reported */
+        double get_best_fitness() const { return best_fitness; }
+};
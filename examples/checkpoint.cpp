@@ -0,0 +1,70 @@
+/* A run of the symbolic example with subsampling, saved to a checkpoint
+ * and loaded into a new optimizer.
+ *
+ * Subsampled scores are only estimates, so they are marked as partial and
+ * best_fitness ignores them. The partial fitness used here overestimates
+ * every subsampled score, so that a loaded optimizer taking them for exact
+ * scores would report a better best_fitness than the one of its best
+ * individual. It exits with status 1 if a check fails, so that
+ * `make check` fails. */
+
+#include <cstdio>
+#include <string>
+
+#include "optimizer.hpp"
+#include "symbolic.hpp"
+
+typedef Optimizer<Symbol,math_type> optimizer_t;
+typedef optimizer_t::individual_t individual_t;
+
+const unsigned int seed = 42;
+const unsigned int population_size = 100;
+const unsigned int generations = 5;
+const char * const path = "examples/checkpoint.ckpt";
+
+bool failed = false;
+
+void check(bool condition, const char *what)
+{
+    if(!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        failed = true;
+    }
+}
+
+double overestimated_fitness(individual_t individual,
+                             const evaluation_request &request)
+{
+    return fitness(individual) + (request.complete() ? 0 : 1);
+}
+
+void configure(optimizer_t &optimizer)
+{
+    optimizer.seed(seed);
+    optimizer.set_partial_fitness(&overestimated_fitness);
+    optimizer.use_subsampling(2);
+}
+
+int main()
+{
+    optimizer_t saved(&fitness, &random_tree, population_size);
+    configure(saved);
+    saved.run(generations);
+    saved.save(path);
+
+    optimizer_t loaded(&fitness, &random_tree, population_size);
+    configure(loaded);
+    loaded.load(path);
+    std::remove(path);
+
+    check(loaded.best_fitness() == saved.best_fitness(),
+          "the best score is the one saved");
+    check(loaded.best_fitness() == fitness(loaded.best()),
+          "the best score is exact");
+    check(loaded.get_generation() == saved.get_generation(),
+          "the generation is the one saved");
+
+    std::printf(failed ? "checkpoint: FAILED\n" : "checkpoint: OK\n");
+    return failed ? 1 : 0;
+}
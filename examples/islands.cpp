@@ -0,0 +1,122 @@
+/* A distributed run of the symbolic example, with the workers and the
+ * coordinator on threads of one process, exchanging messages over a
+ * LocalTransport.
+ *
+ * It checks that messages survive encoding, that the coordinator stops the
+ * workers once the target fitness is reached, and that it collects the
+ * last reports of workers stopping on their own. It exits with status 1 if
+ * any check fails, so that `make check` fails. */
+
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "distributed.hpp"
+#include "optimizer.hpp"
+#include "symbolic.hpp"
+#include "transport.hpp"
+
+typedef Optimizer<Symbol,math_type> optimizer_t;
+typedef optimizer_t::individual_t individual_t;
+
+const unsigned int seed = 42;
+const unsigned int workers = 3;
+const unsigned int population_size = 50;
+const double target_fitness = 0.999;
+/// The duration after which the coordinator gives up, in seconds
+const double timeout = 60;
+
+bool failed = false;
+
+void check(bool condition, const char *what)
+{
+    if(!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        failed = true;
+    }
+}
+
+/** A fitness that never reaches the target, so that the workers stop at
+ * their maximal number of generations */
+double unreachable_fitness(individual_t individual)
+{
+    return fitness(individual) * 0.99;
+}
+
+void check_messages()
+{
+    Xoshiro256 gen(seed);
+    std::vector<std::pair<individual_t,double>> individuals;
+    for(unsigned int i = 0; i < 3; i++)
+        individuals.push_back(std::make_pair(random_tree(gen), i * 0.25));
+    std::vector<char> buffer;
+    encode_message(buffer, island_message::migrants, 2, 7, individuals);
+    auto message = decode_message<Symbol,math_type,Tree>(buffer);
+    check(message.kind == island_message::migrants && message.source == 2
+          && message.generation == 7, "message header round-trip");
+    bool same = message.individuals.size() == individuals.size();
+    for(unsigned int i = 0; same && i < individuals.size(); i++)
+        same = message.individuals[i].first->get_hash()
+            == individuals[i].first->get_hash()
+            && message.individuals[i].second == individuals[i].second;
+    check(same, "message individuals round-trip");
+
+    buffer.resize(buffer.size() - 1);
+    bool rejected = false;
+    try
+    {
+        decode_message<Symbol,math_type,Tree>(buffer);
+    }
+    catch(const std::runtime_error &)
+    {
+        rejected = true;
+    }
+    check(rejected, "truncated message rejected");
+}
+
+/** Runs workers on threads until they are done
+ * \return The best score the coordinator received */
+double run(double (*fitness_function)(individual_t),
+           unsigned int max_generations, bool &complete)
+{
+    auto transport = std::make_shared<LocalTransport>(workers + 1);
+    std::vector<std::thread> threads;
+    for(unsigned int rank = 0; rank < workers; rank++)
+    {
+        threads.emplace_back([=]() {
+            optimizer_t optimizer(fitness_function, &random_tree,
+                                  population_size);
+            optimizer.seed(Xoshiro256(seed).stream(rank).get_seed());
+            IslandWorker<Symbol,math_type> worker(optimizer, transport, rank,
+                    workers, migration_topology::ring, 5);
+            worker.run(target_fitness, max_generations);
+        });
+    }
+    IslandCoordinator<Symbol,math_type> coordinator(transport, workers);
+    coordinator.run(target_fitness, timeout);
+    complete = coordinator.is_complete();
+    for(std::thread &thread : threads)
+        thread.join();
+    return coordinator.get_best_fitness();
+}
+
+int main()
+{
+    check_messages();
+
+    bool complete;
+    double best = run(&fitness, std::numeric_limits<unsigned int>::max(),
+                      complete);
+    check(complete, "every worker reports once stopped");
+    check(best >= target_fitness, "the target fitness is reached");
+
+    best = run(&unreachable_fitness, 20, complete);
+    check(complete, "every worker reports at its last generation");
+    check(best > 0 && best < target_fitness, "the best score is reported");
+
+    std::printf(failed ? "islands: FAILED\n" : "islands: OK\n");
+    return failed ? 1 : 0;
+}
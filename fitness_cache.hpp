@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/** Bounded cache of fitness scores, keyed by the structural hash of trees
+ *
+ * When the cache is full, inserting a new score evicts the least recently
+ * used one. Entries are kept in a doubly linked list threaded through a
+ * vector, so that lookups and insertions do not allocate once the cache is
+ * full.
+ *
+ * Two different trees with the same 64 bits hash share their entry: a
+ * collision is reported as a hit and returns the score of the other tree.
+ * With 64 bits hashes this is rare enough to be ignored. */
+class FitnessCache
+{
+    private:
+        static const std::size_t none = static_cast<std::size_t>(-1);
+
+        struct entry
+        {
+            std::uint64_t key;
+            double score;
+            std::size_t previous;
+            std::size_t next;
+        };
+
+        std::size_t capacity;
+        std::vector<entry> entries;
+        /// From hashes to indices in entries
+        std::unordered_map<std::uint64_t,std::size_t> index;
+        /// The most recently used entry
+        std::size_t head = none;
+        /// The least recently used entry
+        std::size_t tail = none;
+
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+
+        void unlink(std::size_t i)
+        {
+            entry &e = entries[i];
+            if(e.previous != none)
+                entries[e.previous].next = e.next;
+            else
+                head = e.next;
+            if(e.next != none)
+                entries[e.next].previous = e.previous;
+            else
+                tail = e.previous;
+        }
+
+        void push_front(std::size_t i)
+        {
+            entries[i].previous = none;
+            entries[i].next = head;
+            if(head != none)
+                entries[head].previous = i;
+            head = i;
+            if(tail == none)
+                tail = i;
+        }
+
+    public:
+        /** Constructor for FitnessCache
+         * \param capacity The maximum number of scores kept */
+        explicit FitnessCache(std::size_t capacity = 4096)
+            : capacity(capacity ? capacity : 1)
+        {
+            entries.reserve(this->capacity);
+            index.reserve(this->capacity);
+        }
+
+        /** Looks a score up, and marks it as recently used if found
+         * \param key The hash of the tree
+         * \param score Set to the cached score if found
+         * \return Whether the score was in the cache */
+        bool find(std::uint64_t key, double &score)
+        {
+            auto it = index.find(key);
+            if(it == index.end())
+            {
+                misses++;
+                return false;
+            }
+            hits++;
+            unlink(it->second);
+            push_front(it->second);
+            score = entries[it->second].score;
+            return true;
+        }
+
+        /** Adds or updates a score, evicting the least recently used one
+         * if the cache is full
+         * \param key The hash of the tree
+         * \param score Its score */
+        void insert(std::uint64_t key, double score)
+        {
+            auto it = index.find(key);
+            if(it != index.end())
+            {
+                entries[it->second].score = score;
+                unlink(it->second);
+                push_front(it->second);
+                return;
+            }
+            std::size_t i;
+            if(entries.size() < capacity)
+            {
+                i = entries.size();
+                entries.push_back(entry());
+            }
+            else
+            {
+                i = tail;
+                unlink(i);
+                index.erase(entries[i].key);
+            }
+            entries[i].key = key;
+            entries[i].score = score;
+            push_front(i);
+            index.emplace(key, i);
+        }
+
+        /** Removes every score, the statistics are kept */
+        void clear()
+        {
+            entries.clear();
+            index.clear();
+            head = none;
+            tail = none;
+        }
+
+        /** Getter for the number of scores in the cache */
+        std::size_t size() const { return entries.size(); }
+
+        /** Getter for the maximum number of scores in the cache */
+        std::size_t get_capacity() const { return capacity; }
+
+        /** Getter for the number of lookups that found a score */
+        unsigned long get_hits() const { return hits; }
+
+        /** Getter for the number of lookups that did not find a score */
+        unsigned long get_misses() const { return misses; }
+
+        /** Getter for the fraction of lookups that found a score */
+        double hit_rate() const
+        {
+            unsigned long lookups = hits + misses;
+            return lookups ? (double)hits / lookups : 0;
+        }
+
+        /** Resets the hit and miss counters */
+        void reset_statistics()
+        {
+            hits = 0;
+            misses = 0;
+        }
+};
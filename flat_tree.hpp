@@ -0,0 +1,333 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+/** A node of a FlatTree
+ *
+ * Nodes are stored in prefix order, so the subtree rooted at a node is the
+ * contiguous range [index, index + size) of the node array. */
+template<typename T, typename node_type_t>
+struct flat_node
+{
+    /// The value of type T attached to that node.
+    T value;
+    /// The type of the node
+    node_type_t type;
+    /// The number of nodes in the subtree rooted at that node (itself
+    /// included).
+    unsigned int size;
+
+    flat_node(T value, node_type_t type, unsigned int size = 1)
+        : value(value), type(type), size(size) {}
+
+    T & get_node() { return value; }
+    const T & get_node() const { return value; }
+    node_type_t get_type() const { return type; }
+};
+
+/** A tree holding values of type T, stored as one contiguous array
+ *
+ * This class offers the same interface as Tree<T,node_type_t> (and can be
+ * used in its place by Optimizer), but keeps a whole tree as a single
+ * prefix-order array of flat_node instead of one heap allocation per node.
+ * Copying a tree is a single allocation, and visiting it is a linear scan. */
+template<typename T, typename node_type_t>
+class FlatTree
+{
+    public:
+        typedef flat_node<T,node_type_t> node_t;
+        /// The type of the node array, allocated from the current arena
+        typedef std::vector<node_t, tree_allocator<node_t>> nodes_t;
+
+    private:
+        /// The nodes of the tree in prefix order. nodes[0] is the root.
+        nodes_t nodes;
+
+        /** Appends the nodes of tree to this one, converting it from the
+         * pointer-based representation */
+        void append(const Tree<T,node_type_t> &tree)
+        {
+            unsigned int index = nodes.size();
+            nodes.push_back(node_t(tree.get_node(), tree.get_type()));
+            for(auto child : tree.get_children())
+                append(*child);
+            nodes[index].size = nodes.size() - index;
+        }
+
+        /** Finds the index of the node at a given position
+         * \param position The position of the node
+         * \param ancestors If not null, the indices of the strict ancestors
+         * of the node are appended to it
+         * \return The index of the node in the node array */
+        unsigned int index_of(const pos &position,
+                              std::vector<unsigned int> *ancestors = nullptr) const
+        {
+            unsigned int index = 0;
+            for(unsigned int child : position)
+            {
+                if(ancestors)
+                    ancestors->push_back(index);
+                index++;
+                for(unsigned int i = 0; i < child; i++)
+                    index += nodes[index].size;
+            }
+            return index;
+        }
+
+        /** Computes the position of the node at a given index
+         * \param index The index of the node in the node array
+         * \return The position of the node */
+        pos position_of(unsigned int index) const
+        {
+            pos position;
+            unsigned int current = 0;
+            while(current != index)
+            {
+                unsigned int child = current + 1;
+                unsigned int i = 0;
+                while(index >= child + nodes[child].size)
+                {
+                    child += nodes[child].size;
+                    i++;
+                }
+                position.push_back(i);
+                current = child;
+            }
+            return position;
+        }
+
+        /** Prints the subtree at a given index
+         * \return The index following that subtree */
+        unsigned int print(std::ostream &os, unsigned int index) const
+        {
+            os << nodes[index].value << "(";
+            unsigned int end = index + nodes[index].size;
+            index++;
+            while(index < end)
+            {
+                index = print(os, index);
+                os << ",";
+            }
+            os << ")";
+            return index;
+        }
+
+    public:
+        FlatTree(T node, node_type_t type)
+        { nodes.push_back(node_t(node, type)); }
+        /** Copy constructor
+         *
+         * The copy is allocated in the current arena (see make_tree) */
+        FlatTree(const FlatTree<T,node_type_t> &copy)
+            : nodes(copy.nodes.begin(), copy.nodes.end()) {}
+        /** Copies the whole tree, in the current arena (see make_tree)
+         *
+         * FlatTree never shares nodes, so this is the copy constructor. It
+         * exists to offer the same interface as Tree.
+         * \return The copy */
+        std::shared_ptr<FlatTree<T,node_type_t>> clone() const
+        { return make_tree<FlatTree<T,node_type_t>>(*this); }
+        FlatTree(T node, node_type_t type,
+                 std::vector<std::shared_ptr<FlatTree<T,node_type_t>>> children)
+        {
+            nodes.push_back(node_t(node, type));
+            for(auto child : children)
+                add(child);
+        }
+        /** Conversion from the pointer-based representation */
+        explicit FlatTree(const Tree<T,node_type_t> &tree)
+        { append(tree); }
+        /** Constructor from a node array
+         * \param nodes The nodes in prefix order, with the sizes of their
+         * subtrees set */
+        explicit FlatTree(nodes_t &&nodes) : nodes(std::move(nodes)) {}
+
+        /** Adds given children to the children of the tree
+         * \param child The child to add */
+        void add(std::shared_ptr<FlatTree<T,node_type_t>> child)
+        {
+            nodes.insert(nodes.end(), child->nodes.begin(), child->nodes.end());
+            nodes[0].size = nodes.size();
+        }
+
+        /** Getter for the value of type T attached to the root
+         * \return A reference to the held value */
+        T & get_node() { return nodes[0].value; }
+        /** Const getter for the value of type T attached to the root
+         * \return A const reference to the held value */
+        const T & get_node() const { return nodes[0].value; }
+        /** Getter for the root type
+         * \return The type of the root */
+        node_type_t get_type() const { return nodes[0].type; }
+        /** Getter for the node array
+         * \return The nodes of the tree in prefix order */
+        const nodes_t & get_nodes() const { return nodes; }
+        /** Getter for the number of nodes in the tree */
+        unsigned int size() const { return nodes.size(); }
+        /** Getter for the number of nodes in the tree, as Tree::get_size */
+        unsigned int get_size() const { return nodes.size(); }
+        /** Computes the number of levels of the tree, 1 for a leaf
+         *
+         * It is not stored, computing it is a linear scan of the nodes. */
+        unsigned int get_depth() const
+        {
+            // The ends of the subtrees enclosing the current node
+            std::vector<unsigned int> ends;
+            unsigned int depth = 0;
+            for(unsigned int i = 0; i < nodes.size(); i++)
+            {
+                while(!ends.empty() && ends.back() <= i)
+                    ends.pop_back();
+                ends.push_back(i + nodes[i].size);
+                if(ends.size() > depth)
+                    depth = ends.size();
+            }
+            return depth;
+        }
+        /** Computes the structural hash of the tree
+         *
+         * The hash is the same as the one of the equivalent Tree. It is not
+         * stored, computing it is a linear scan of the nodes.
+         * \return The hash */
+        std::uint64_t get_hash() const
+        {
+            // Scanning backwards, the hashes of the children of a node are
+            // on top of the stack, first child on top
+            std::vector<std::uint64_t> stack;
+            for(unsigned int i = nodes.size(); i-- > 0;)
+            {
+                node_hasher<T,node_type_t> hasher(nodes[i].value,
+                                                  nodes[i].type);
+                unsigned int end = i + nodes[i].size;
+                for(unsigned int child = i + 1; child < end;
+                    child += nodes[child].size)
+                {
+                    hasher.add_child(stack.back());
+                    stack.pop_back();
+                }
+                stack.push_back(hasher.hash);
+            }
+            return stack.back();
+        }
+
+        /** Getter for a particular subtree of that tree
+         * \param position The position of the subtree to return within that
+         * tree
+         * \return A copy of the corresponding subtree */
+        std::shared_ptr<FlatTree<T,node_type_t>> get_subtree(const pos &position) const
+        {
+            unsigned int index = index_of(position);
+            auto subtree = make_tree<FlatTree<T,node_type_t>>(
+                    nodes[index].value, nodes[index].type);
+            subtree->nodes.assign(nodes.begin() + index,
+                                  nodes.begin() + index + nodes[index].size);
+            return subtree;
+        }
+
+        /** This function applies visit_func to all nodes depth-first
+         * \param visit_func The function to apply to each node */
+        void visit(std::function<void(node_t*,const pos&)> visit_func)
+        {
+            struct open_node { unsigned int end; unsigned int next_child; };
+            std::vector<open_node> open;
+            pos position;
+            for(unsigned int i = 0; i < nodes.size(); i++)
+            {
+                while(!open.empty() && i >= open.back().end)
+                {
+                    open.pop_back();
+                    position.pop_back();
+                }
+                if(!open.empty())
+                    position.push_back(open.back().next_child++);
+                visit_func(&nodes[i], position);
+                open.push_back({i + nodes[i].size, 0});
+            }
+        }
+
+        /** This function replaces the subtree at a given position by
+         * another tree
+         * \param newtree The tree that will replace the subtree
+         * \param position The positon at which the replacement will
+         * be made */
+        void replace(const std::shared_ptr<FlatTree<T,node_type_t>> &newtree,
+                     const pos &position)
+        {
+            std::vector<unsigned int> ancestors;
+            unsigned int index = index_of(position, &ancestors);
+            int delta = (int)newtree->nodes.size() - (int)nodes[index].size;
+            // Copy first, newtree may alias this tree
+            nodes_t inserted = newtree->nodes;
+            nodes.erase(nodes.begin() + index,
+                        nodes.begin() + index + nodes[index].size);
+            nodes.insert(nodes.begin() + index, inserted.begin(), inserted.end());
+            for(unsigned int ancestor : ancestors)
+                nodes[ancestor].size += delta;
+        }
+
+        /** This function returns a uniformly distributed random position
+         * whose subtree is of given type  within the tree
+         *
+         * Matching nodes are counted in one scan of the node array, then a
+         * single random draw picks one of them.
+         * \param type The type of the subtree to get
+         * \param gen The random number generator to use
+         * \return A tuple (has_found,position) */
+        template<typename rng_t>
+        std::pair<bool,pos> random_position(node_type_t type,
+                                            rng_t &gen) const
+        {
+            unsigned int count = 0;
+            for(const node_t &node : nodes)
+                if(node.type == type)
+                    count++;
+            if(count == 0)
+                return std::pair<bool,pos>(false, pos());
+            std::uniform_int_distribution<unsigned int> dis(0, count - 1);
+            unsigned int k = dis(gen);
+            for(unsigned int i = 0; i < nodes.size(); i++)
+            {
+                if(nodes[i].type == type && k-- == 0)
+                    return std::pair<bool,pos>(true, position_of(i));
+            }
+            return std::pair<bool,pos>(false, pos());
+        }
+        std::pair<bool,pos> random_position(node_type_t type)
+        { return random_position(type, thread_generator()); }
+
+        /** This function returns a uniformly distributed random position
+         * within the tree
+         *
+         * A single random draw picks an index in the node array, then its
+         * position is found in O(depth).
+         * \param gen The random number generator to use
+         * \return The position */
+        template<typename rng_t>
+        pos random_position(rng_t &gen) const
+        {
+            std::uniform_int_distribution<unsigned int> dis(0, nodes.size() - 1);
+            return position_of(dis(gen));
+        }
+        pos random_position() { return random_position(thread_generator()); }
+
+        /** Output function */
+        template<typename U, typename Unode_type_t>
+        friend std::ostream & operator<<(std::ostream & os,
+                const FlatTree<U, Unode_type_t> & tree);
+};
+
+template<typename T, typename node_type_t>
+std::ostream & operator<<(std::ostream & os, const FlatTree<T,node_type_t> & tree)
+{
+    tree.print(os, 0);
+    return os;
+}
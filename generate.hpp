@@ -0,0 +1,195 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "arena.hpp"
+#include "random.hpp"
+#include "tree.hpp"
+
+/** The nodes random trees are made of
+ *
+ * A function is a node whose children have given types, a terminal is a
+ * leaf. Trees are generated without recursion: the nodes are first drawn in
+ * prefix order, keeping the pending children on a stack, then built from
+ * the last one to the first. Generating a tree thus takes bounded stack
+ * space whatever its depth. */
+template<typename T, typename node_type_t>
+class Grammar
+{
+    private:
+        struct primitive
+        {
+            T value;
+            node_type_t type;
+            std::vector<node_type_t> arguments;
+        };
+
+        /// The primitives producing one node type
+        struct production
+        {
+            node_type_t type;
+            std::vector<unsigned int> functions;
+            std::vector<unsigned int> terminals;
+        };
+
+        /// A child waiting to be drawn
+        struct slot
+        {
+            node_type_t type;
+            /// The level of the child, 1 for the root
+            unsigned int level;
+        };
+
+        std::vector<primitive> primitives;
+        std::vector<production> productions;
+
+        production & production_of(node_type_t type)
+        {
+            for(production &p : productions)
+                if(p.type == type)
+                    return p;
+            productions.push_back(production{type, {}, {}});
+            return productions.back();
+        }
+
+        const production & production_of(node_type_t type) const
+        {
+            for(const production &p : productions)
+                if(p.type == type)
+                    return p;
+            throw std::invalid_argument("no primitive of the requested type");
+        }
+
+    public:
+        /** Adds a node with children
+         * \param value The value of the node
+         * \param type The type of the node
+         * \param arguments The types of its children */
+        void add_function(const T &value, node_type_t type,
+                          const std::vector<node_type_t> &arguments)
+        {
+            production_of(type).functions.push_back(primitives.size());
+            primitives.push_back(primitive{value, type, arguments});
+        }
+
+        /** Adds a leaf
+         * \param value The value of the leaf
+         * \param type The type of the leaf */
+        void add_terminal(const T &value, node_type_t type)
+        {
+            production_of(type).terminals.push_back(primitives.size());
+            primitives.push_back(primitive{value, type, {}});
+        }
+
+        /** Generates a random tree, in the current arena
+         *
+         * The full method only takes functions above the last level, so
+         * that every branch reaches it. The grow method draws among all
+         * the primitives, so branches stop at any level. Terminals are also
+         * taken once a function would make the tree exceed max_nodes.
+         * \param gen The random number generator to use
+         * \param type The type of the root
+         * \param depth The maximal number of levels, 1 for a leaf
+         * \param full Whether to use the full method rather than grow
+         * \param max_nodes The maximal number of nodes, 0 for no limit
+         * \return The tree, a Tree or a FlatTree according to tree_t
+         * \throw std::invalid_argument If a type with no terminal is
+         * needed where a leaf has to be taken */
+        template<template<typename,typename> class tree_t = Tree>
+        std::shared_ptr<tree_t<T,node_type_t>> generate(Xoshiro256 &gen,
+                node_type_t type, unsigned int depth, bool full,
+                unsigned int max_nodes = 0) const
+        {
+            // The primitives of the nodes, in prefix order
+            std::vector<unsigned int> drawn;
+            std::vector<slot> pending(1, slot{type, 1});
+            while(!pending.empty())
+            {
+                slot current = pending.back();
+                pending.pop_back();
+                const production &p = production_of(current.type);
+                // The nodes the tree has at least, with one more child
+                unsigned int planned = drawn.size() + pending.size() + 1;
+                bool leaf = current.level >= depth || p.functions.empty()
+                    || (max_nodes && planned >= max_nodes);
+                unsigned int index;
+                if(leaf)
+                {
+                    if(p.terminals.empty())
+                        throw std::invalid_argument(
+                                "no terminal of a required type");
+                    index = p.terminals[gen.below(p.terminals.size())];
+                }
+                else if(full || p.terminals.empty())
+                {
+                    index = p.functions[gen.below(p.functions.size())];
+                }
+                else
+                {
+                    unsigned int k = gen.below(p.functions.size()
+                                               + p.terminals.size());
+                    index = k < p.functions.size() ? p.functions[k]
+                        : p.terminals[k - p.functions.size()];
+                }
+                const primitive &chosen = primitives[index];
+                if(max_nodes && !chosen.arguments.empty()
+                   && planned + chosen.arguments.size() > max_nodes)
+                {
+                    if(p.terminals.empty())
+                        throw std::invalid_argument(
+                                "no terminal of a required type");
+                    index = p.terminals[gen.below(p.terminals.size())];
+                }
+                drawn.push_back(index);
+                // The first child is drawn next, to keep prefix order
+                const std::vector<node_type_t> &arguments =
+                    primitives[index].arguments;
+                for(unsigned int i = arguments.size(); i-- > 0;)
+                    pending.push_back(slot{arguments[i], current.level + 1});
+            }
+
+            // Built backwards, the children of a node are on top of the
+            // stack, first child on top
+            std::vector<std::shared_ptr<tree_t<T,node_type_t>>> built;
+            std::vector<std::shared_ptr<tree_t<T,node_type_t>>> children;
+            for(unsigned int i = drawn.size(); i-- > 0;)
+            {
+                const primitive &node = primitives[drawn[i]];
+                children.clear();
+                for(unsigned int j = 0; j < node.arguments.size(); j++)
+                {
+                    children.push_back(built.back());
+                    built.pop_back();
+                }
+                built.push_back(make_tree<tree_t<T,node_type_t>>(
+                            node.value, node.type, children));
+            }
+            return built.back();
+        }
+
+        /** Generates a random tree with the ramped half-and-half method
+         *
+         * The depth is drawn uniformly in [min_depth, max_depth], and the
+         * full or the grow method is used with equal probability, so that
+         * a population gets trees of diverse shapes and sizes.
+         * \param gen The random number generator to use
+         * \param type The type of the root
+         * \param min_depth The minimal depth drawn
+         * \param max_depth The maximal depth drawn
+         * \param max_nodes The maximal number of nodes, 0 for no limit
+         * \return The tree, a Tree or a FlatTree according to tree_t */
+        template<template<typename,typename> class tree_t = Tree>
+        std::shared_ptr<tree_t<T,node_type_t>> ramped_half_and_half(
+                Xoshiro256 &gen, node_type_t type, unsigned int min_depth,
+                unsigned int max_depth, unsigned int max_nodes = 0) const
+        {
+            if(max_depth < min_depth)
+                max_depth = min_depth;
+            unsigned int depth = min_depth
+                + gen.below(max_depth - min_depth + 1);
+            bool full = gen.below(2) == 0;
+            return generate<tree_t>(gen, type, depth, full, max_nodes);
+        }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "flat_tree.hpp"
+#include "tree.hpp"
+
+/** Store of canonical nodes, sharing structurally identical subtrees
+ * (hash-consing)
+ *
+ * intern replaces every subtree of a tree by the canonical node with the
+ * same value, type and children, if one exists, and registers the others
+ * as canonical. Identical subtrees of all the interned trees are then
+ * stored once, whether they come from cross over or were built
+ * separately. Values are compared with operator== of T and children by
+ * address, since they are canonical themselves.
+ *
+ * The store only holds weak pointers: canonical nodes are freed with the
+ * last tree using them, and the entries of freed nodes are swept when the
+ * table has doubled since the previous sweep. Trees stay modifiable as
+ * usual: replace copies shared nodes, and a node modified in place no
+ * longer matches its old entry, which is then ignored.
+ *
+ * The nodes of the store must outlive it, or it must be cleared before
+ * they are freed all at once, as when their arena is reset. A store must
+ * not be shared between threads. */
+template<typename T, typename node_type_t>
+class NodeStore
+{
+    public:
+        typedef std::shared_ptr<Tree<T,node_type_t>> tree_ptr_t;
+
+    private:
+        std::unordered_multimap<std::uint64_t,
+                                std::weak_ptr<Tree<T,node_type_t>>> nodes;
+        /// The size of the table that triggers the next sweep
+        std::size_t sweep_size = 1024;
+
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+
+        /** Drops the entries of freed nodes */
+        void sweep()
+        {
+            for(auto it = nodes.begin(); it != nodes.end();)
+            {
+                if(it->second.expired())
+                    it = nodes.erase(it);
+                else
+                    it++;
+            }
+            sweep_size = std::max<std::size_t>(1024, 2 * nodes.size());
+        }
+
+        /** Finds the canonical node of a value, a type and canonical
+         * children
+         * \return The node, nullptr if there is none */
+        tree_ptr_t find(std::uint64_t hash, const Tree<T,node_type_t> &tree,
+                        const std::vector<tree_ptr_t> &children) const
+        {
+            auto range = nodes.equal_range(hash);
+            for(auto it = range.first; it != range.second; it++)
+            {
+                tree_ptr_t node = it->second.lock();
+                if(!node || node->get_type() != tree.get_type()
+                   || !(node->get_node() == tree.get_node())
+                   || node->get_children().size() != children.size())
+                    continue;
+                bool same = true;
+                for(std::size_t i = 0; i < children.size() && same; i++)
+                    same = node->get_children()[i] == children[i];
+                if(same)
+                    return node;
+            }
+            return nullptr;
+        }
+
+        /** Checks whether a node is canonical
+         *
+         * A node modified in place since it was registered has a new hash,
+         * under which it is not registered. */
+        bool is_canonical(const tree_ptr_t &tree) const
+        {
+            auto range = nodes.equal_range(tree->get_hash());
+            for(auto it = range.first; it != range.second; it++)
+                if(!it->second.owner_before(tree)
+                   && !tree.owner_before(it->second) && !it->second.expired())
+                    return true;
+            return false;
+        }
+
+        tree_ptr_t canonical(const tree_ptr_t &tree, bool copy)
+        {
+            // The subtrees of a canonical node are canonical, which makes
+            // interning the survivors of a generation O(1)
+            if(!copy && is_canonical(tree))
+            {
+                hits++;
+                return tree;
+            }
+            std::vector<tree_ptr_t> children;
+            bool changed = copy;
+            for(const tree_ptr_t &child : tree->get_children())
+            {
+                children.push_back(canonical(child, copy));
+                changed = changed || children.back() != child;
+            }
+            // Children are replaced by nodes of the same structure, so the
+            // hash does not change
+            tree_ptr_t found = find(tree->get_hash(), *tree, children);
+            if(found)
+            {
+                hits++;
+                return found;
+            }
+            misses++;
+            tree_ptr_t result = tree;
+            if(changed)
+                result = make_tree<Tree<T,node_type_t>>(tree->get_node(),
+                        tree->get_type(), children);
+            if(nodes.size() >= sweep_size)
+                sweep();
+            nodes.emplace(result->get_hash(), result);
+            return result;
+        }
+
+    public:
+        /** Replaces the subtrees of a tree by canonical nodes
+         *
+         * The nodes of the tree that have no canonical equivalent become
+         * canonical. Nodes are only allocated, in the current arena, when
+         * some of their children were replaced.
+         * \param tree The tree, which is not modified
+         * \return The canonical tree, tree itself if it is canonical */
+        tree_ptr_t intern(const tree_ptr_t &tree)
+        { return canonical(tree, false); }
+
+        /** FlatTree nodes are not shared: the tree is returned unchanged */
+        std::shared_ptr<FlatTree<T,node_type_t>> intern(
+                const std::shared_ptr<FlatTree<T,node_type_t>> &tree)
+        { return tree; }
+
+        /** Copies a tree to the current arena, sharing its identical
+         * subtrees and the ones of the trees copied since the store was
+         * last cleared
+         *
+         * Unlike intern, no node of the tree is reused, so the store must
+         * be cleared first if it holds nodes of other arenas.
+         * \param tree The tree to copy
+         * \return The copy */
+        tree_ptr_t copy(const tree_ptr_t &tree)
+        { return canonical(tree, true); }
+
+        std::shared_ptr<FlatTree<T,node_type_t>> copy(
+                const std::shared_ptr<FlatTree<T,node_type_t>> &tree)
+        { return tree->clone(); }
+
+        /** Forgets every canonical node */
+        void clear()
+        {
+            nodes.clear();
+            sweep_size = 1024;
+        }
+
+        /** Getter for the number of entries, including the ones of freed
+         * nodes not swept yet */
+        std::size_t size() const { return nodes.size(); }
+
+        /** Getter for the number of subtrees found in the store */
+        unsigned long get_hits() const { return hits; }
+
+        /** Getter for the number of subtrees registered as canonical */
+        unsigned long get_misses() const { return misses; }
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "tree.hpp"
+
+/** Evaluates trees over a dataset, keeping the output column of every
+ * evaluated subtree
+ *
+ * Columns are cached by structural hash (see Tree::get_hash). Since
+ * replace only changes the hashes of the nodes between the root and the
+ * replaced subtree, evaluating a tree after a cross over only computes the
+ * columns of these nodes: every other subtree is found in the cache. The
+ * same goes for subtrees shared by several individuals.
+ *
+ * The cache is bounded by a number of values. When it is full at the start
+ * of a run, the columns not used since the previous sweep are dropped. Two
+ * subtrees with the same 64 bits hash share their column, which is rare
+ * enough to be ignored (see FitnessCache).
+ *
+ * An evaluator keeps its cache between calls, so it must not be shared
+ * between threads. */
+template<typename value_t>
+class IncrementalEvaluator
+{
+    private:
+        struct entry
+        {
+            std::vector<value_t> column;
+            /// The sweep during which the column was last used
+            unsigned long last_used;
+        };
+
+        /// The input columns of the dataset
+        std::vector<const value_t*> inputs;
+        std::size_t rows;
+        /// The maximum number of columns kept
+        std::size_t capacity;
+
+        std::unordered_map<std::uint64_t,entry> columns;
+        /// Columns of dropped entries, kept to reuse their memory
+        std::vector<std::vector<value_t>> free_columns;
+        /// Columns of the children of the nodes being evaluated
+        std::vector<const value_t*> operands;
+        /// Arguments of call instructions
+        std::vector<value_t> arguments;
+        unsigned long sweeps = 0;
+
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+
+        /** Drops the columns not used since the previous sweep, or all of
+         * them if every column was used */
+        void sweep()
+        {
+            for(auto it = columns.begin(); it != columns.end();)
+            {
+                if(it->second.last_used < sweeps)
+                {
+                    free_columns.push_back(std::move(it->second.column));
+                    it = columns.erase(it);
+                }
+                else
+                    it++;
+            }
+            if(columns.size() >= capacity)
+            {
+                for(auto &dropped : columns)
+                    free_columns.push_back(std::move(dropped.second.column));
+                columns.clear();
+            }
+            sweeps++;
+        }
+
+        /** Computes the column of a node from the columns of its children
+         * \param op The instruction of the node
+         * \param operands The columns of the children
+         * \param n The number of children
+         * \param out The column of the node, of size rows */
+        void apply(const instruction<value_t> &op,
+                   const value_t * const *operands, std::size_t n,
+                   value_t *out)
+        {
+            switch(op.code)
+            {
+                case opcode::constant:
+                    kernels::fill(out, op.value, rows);
+                    break;
+                case opcode::variable:
+                    std::copy(inputs[op.index], inputs[op.index] + rows, out);
+                    break;
+                case opcode::add:
+                    // add and mul can have any number of operands, without
+                    // any they give their identity
+                    if(n == 0)
+                        kernels::fill(out, value_t(0), rows);
+                    else if(n == 1)
+                        std::copy(operands[0], operands[0] + rows, out);
+                    else
+                        kernels::add(out, operands[0], operands[1], rows);
+                    for(std::size_t i = 2; i < n; i++)
+                        kernels::add(out, out, operands[i], rows);
+                    break;
+                case opcode::sub:
+                    kernels::sub(out, operands[0], operands[1], rows);
+                    break;
+                case opcode::mul:
+                    if(n == 0)
+                        kernels::fill(out, value_t(1), rows);
+                    else if(n == 1)
+                        std::copy(operands[0], operands[0] + rows, out);
+                    else
+                        kernels::mul(out, operands[0], operands[1], rows);
+                    for(std::size_t i = 2; i < n; i++)
+                        kernels::mul(out, out, operands[i], rows);
+                    break;
+                case opcode::div:
+                    kernels::div(out, operands[0], operands[1], rows);
+                    break;
+                case opcode::neg:
+                    kernels::neg(out, operands[0], rows);
+                    break;
+                case opcode::call:
+                    arguments.resize(n);
+                    for(std::size_t row = 0; row < rows; row++)
+                    {
+                        for(std::size_t i = 0; i < n; i++)
+                            arguments[i] = operands[i][row];
+                        out[row] = op.function(arguments.data());
+                    }
+                    break;
+            }
+        }
+
+        template<typename T, typename node_type_t, typename encoder_t>
+        const value_t * evaluate(const Tree<T,node_type_t> &tree,
+                                 encoder_t &encode)
+        {
+            instruction<value_t> op = encode(tree.get_node());
+            if(op.code == opcode::variable)
+                return inputs[op.index];
+            auto found = columns.find(tree.get_hash());
+            if(found != columns.end())
+            {
+                hits++;
+                found->second.last_used = sweeps;
+                return found->second.column.data();
+            }
+            misses++;
+            // The operands of the children are pushed above the ones of
+            // their ancestors, so operands is shared by the whole descent
+            std::size_t base = operands.size();
+            for(auto &child : tree.get_children())
+            {
+                const value_t *column = evaluate(*child, encode);
+                operands.push_back(column);
+            }
+            std::vector<value_t> column;
+            if(!free_columns.empty())
+            {
+                column = std::move(free_columns.back());
+                free_columns.pop_back();
+            }
+            column.resize(rows);
+            apply(op, operands.data() + base, operands.size() - base,
+                  column.data());
+            operands.resize(base);
+            entry &stored = columns[tree.get_hash()];
+            stored.column = std::move(column);
+            stored.last_used = sweeps;
+            return stored.column.data();
+        }
+
+    public:
+        /** Constructor for IncrementalEvaluator
+         * \param data The fitness cases, which must outlive the evaluator
+         * \param max_values The maximum number of values kept in the
+         * cache, over all columns */
+        explicit IncrementalEvaluator(const Dataset<value_t> &data,
+                                      std::size_t max_values = 1 << 22)
+            : inputs(data.columns()), rows(data.rows()),
+            capacity(rows ? max_values / rows : max_values)
+        {
+            if(capacity == 0)
+                capacity = 1;
+        }
+
+        /** Evaluates a tree on every fitness case
+         * \param tree The tree to evaluate
+         * \param encode A function returning the instruction<value_t> of
+         * the value of type T attached to a node (see compile)
+         * \return The output column, of size rows. It is valid until the
+         * next call. */
+        template<typename T, typename node_type_t, typename encoder_t>
+        const value_t * run(const Tree<T,node_type_t> &tree,
+                            encoder_t encode)
+        {
+            // Columns are only dropped between runs, so that the columns of
+            // the tree being evaluated stay valid
+            if(columns.size() >= capacity)
+                sweep();
+            return evaluate(tree, encode);
+        }
+
+        /** Drops every cached column */
+        void clear()
+        {
+            columns.clear();
+            free_columns.clear();
+        }
+
+        /** Getter for the number of cached columns */
+        std::size_t size() const { return columns.size(); }
+
+        /** Getter for the number of subtrees found in the cache */
+        unsigned long get_hits() const { return hits; }
+
+        /** Getter for the number of subtrees that had to be computed */
+        unsigned long get_misses() const { return misses; }
+
+        /** Getter for the fraction of subtrees found in the cache */
+        double hit_rate() const
+        {
+            unsigned long lookups = hits + misses;
+            return lookups ? (double)hits / lookups : 0;
+        }
+};
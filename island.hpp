@@ -0,0 +1,252 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "optimizer.hpp"
+#include "random.hpp"
+
+/** The islands an island sends its migrants to */
+enum class migration_topology
+{
+    /// To the next island, the last one sending to the first
+    ring,
+    /// To every other island
+    fully_connected,
+    /// To one other island drawn at random at each migration
+    random
+};
+
+/** Island model genetic optimizer
+ *
+ * Several independent Optimizer populations (islands) evolve on their own
+ * threads. Every few generations, each island sends copies of its best
+ * individuals to other islands, where they replace the worst individuals.
+ * Islands never wait for each other: migrants are left in the mailbox of
+ * the destination, which picks them up at its own next migration.
+ *
+ * eval_fitness and rand_individual are called concurrently from the island
+ * threads, so both must be thread-safe (see Optimizer).
+ *
+ * The islands and their migrations draw from streams derived from a single
+ * seed (see seed). Since islands do not wait for each other, the
+ * generation at which migrants arrive depends on the scheduling of the
+ * threads: only runs without migrations are reproducible. */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t = Tree,
+         typename fitness_t
+             = std::function<double(tree_ptr<T,node_type_t,tree_t>)>>
+class IslandOptimizer
+{
+    public:
+        typedef Optimizer<T,node_type_t,tree_t,fitness_t> optimizer_t;
+        typedef typename optimizer_t::individual_t individual_t;
+        typedef std::pair<individual_t,double> migrant_t;
+
+    private:
+        struct island
+        {
+            std::unique_ptr<optimizer_t> optimizer;
+            /// Protects inbox
+            std::mutex mutex;
+            /// The migrants sent to that island and not yet received
+            std::vector<migrant_t> inbox;
+            /// The exception that stopped the island, if any
+            std::exception_ptr error;
+        };
+
+        std::vector<std::unique_ptr<island>> islands;
+        migration_topology topology;
+        /// The number of generations between migrations
+        const unsigned int interval;
+        /// The number of individuals an island sends at each migration
+        const unsigned int migrants;
+        /// Set when an island reaches the target fitness
+        std::atomic<bool> done;
+
+        /// The generator the streams of the islands are derived from
+        Xoshiro256 root;
+
+        /** Getter for the islands a given island sends its migrants to */
+        std::vector<unsigned int> destinations(unsigned int from,
+                                               Xoshiro256 &gen)
+        {
+            unsigned int n = islands.size();
+            std::vector<unsigned int> result;
+            if(n < 2)
+                return result;
+            switch(topology)
+            {
+                case migration_topology::ring:
+                    result.push_back((from + 1) % n);
+                    break;
+                case migration_topology::fully_connected:
+                    for(unsigned int i = 0; i < n; i++)
+                        if(i != from)
+                            result.push_back(i);
+                    break;
+                case migration_topology::random:
+                    result.push_back((from + 1 + gen.below(n - 1)) % n);
+                    break;
+            }
+            return result;
+        }
+
+        /** Sends the best individuals of an island to its destinations,
+         * then inserts the migrants waiting in its inbox */
+        void migrate(unsigned int from, Xoshiro256 &gen)
+        {
+            // elite copies the migrants out of the island, and immigrate
+            // copies them again into the arena of each destination, so
+            // destinations can share them: they only read them
+            std::vector<migrant_t> elite =
+                islands[from]->optimizer->elite(migrants);
+            for(unsigned int to : destinations(from, gen))
+            {
+                std::lock_guard<std::mutex> lock(islands[to]->mutex);
+                islands[to]->inbox.insert(islands[to]->inbox.end(),
+                                          elite.begin(), elite.end());
+            }
+
+            std::vector<migrant_t> received;
+            {
+                std::lock_guard<std::mutex> lock(islands[from]->mutex);
+                received.swap(islands[from]->inbox);
+            }
+            if(!received.empty())
+                islands[from]->optimizer->immigrate(received);
+        }
+
+        /** Evolves one island until it has run a number of generations or
+         * an island has reached the target fitness */
+        void evolve(unsigned int index, unsigned int steps,
+                    double target_fitness)
+        {
+            optimizer_t &optimizer = *islands[index]->optimizer;
+            // Streams 0 to n - 1 seed the islands themselves
+            Xoshiro256 gen = root.stream(islands.size() + index);
+            try
+            {
+                optimizer.initialize();
+                for(unsigned int i = 0; i < steps && !done; i++)
+                {
+                    if(optimizer.best_fitness() >= target_fitness)
+                        break;
+                    optimizer.next_generation();
+                    if((i + 1) % interval == 0)
+                        migrate(index, gen);
+                }
+                if(optimizer.best_fitness() >= target_fitness)
+                    done = true;
+            }
+            catch(...)
+            {
+                islands[index]->error = std::current_exception();
+                done = true;
+            }
+        }
+
+        individual_t evolve(unsigned int steps, double target_fitness)
+        {
+            done = false;
+            std::vector<std::thread> threads;
+            for(unsigned int i = 0; i < islands.size(); i++)
+                threads.emplace_back([this, i, steps, target_fitness]() {
+                            evolve(i, steps, target_fitness);
+                        });
+            for(std::thread &thread : threads)
+                thread.join();
+
+            individual_t best;
+            double best_fitness = -std::numeric_limits<double>::infinity();
+            for(auto &isl : islands)
+            {
+                if(isl->error)
+                    std::rethrow_exception(isl->error);
+                isl->inbox.clear();
+                if(isl->optimizer->best_fitness() > best_fitness)
+                {
+                    best_fitness = isl->optimizer->best_fitness();
+                    best = isl->optimizer->best();
+                }
+            }
+            return best;
+        }
+
+    public:
+        /** Constructor for IslandOptimizer
+         * \param eval_fitness The fitness function
+         * \param rand_individual The generator of random individuals
+         * \param island_count The number of islands, each one runs on its
+         * own thread
+         * \param island_population The population of each island
+         * \param topology Where each island sends its migrants
+         * \param interval The number of generations between migrations
+         * \param migrants The number of individuals sent by an island at
+         * each migration
+         * \param selection The selection strategy of the islands, shared
+         * by all of them */
+        IslandOptimizer(
+                fitness_t eval_fitness,
+                std::function<individual_t(Xoshiro256&)> rand_individual,
+                unsigned int island_count = 4,
+                unsigned int island_population = 100,
+                migration_topology topology = migration_topology::ring,
+                unsigned int interval = 10,
+                unsigned int migrants = 2,
+                std::shared_ptr<SelectionStrategy> selection
+                    = std::make_shared<BernoulliSelection>())
+            : topology(topology), interval(interval ? interval : 1),
+            migrants(migrants), done(false)
+        {
+            for(unsigned int i = 0; i < island_count; i++)
+            {
+                islands.emplace_back(new island());
+                islands.back()->optimizer.reset(new optimizer_t(
+                            eval_fitness, rand_individual, island_population,
+                            selection));
+            }
+            seed(random_seed());
+        }
+
+        /** Seeds the optimizers of the islands and the migrations
+         *
+         * Each island gets its own stream of the seed, so islands with the
+         * same configuration still explore differently.
+         * \param value The seed */
+        void seed(std::uint64_t value)
+        {
+            root.seed(value);
+            for(unsigned int i = 0; i < islands.size(); i++)
+                islands[i]->optimizer->seed(root.stream(i).get_seed());
+        }
+
+        /** Getter for the seed of the islands */
+        std::uint64_t get_seed() const { return root.get_seed(); }
+
+        /** Getter for the optimizer of an island, to configure it */
+        optimizer_t & get_island(unsigned int index)
+        { return *islands[index]->optimizer; }
+
+        /** Runs every island for a given number of generations
+         * \return The best individual over all islands */
+        individual_t run(unsigned int steps = 10)
+        {
+            return evolve(steps, std::numeric_limits<double>::infinity());
+        }
+
+        /** Runs the islands until one of them reaches a target fitness
+         * \return The best individual over all islands */
+        individual_t run_until_fitness(double target_fitness)
+        {
+            return evolve(std::numeric_limits<unsigned int>::max(),
+                          target_fitness);
+        }
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+/** What an Optimizer did during one generation
+ *
+ * Durations are in seconds. Allocation and cache counts are the increase
+ * of the counters during the generation: allocation counters are process
+ * wide (see get_allocation_counters), so they also count the allocations of
+ * other optimizers running at the same time. */
+struct generation_metrics
+{
+    /// The generation, 0 being the initial population
+    unsigned int generation = 0;
+
+    double selection_seconds = 0;
+    double cross_over_seconds = 0;
+    double populate_seconds = 0;
+    double scoring_seconds = 0;
+
+    /// The number of calls to the fitness function
+    unsigned long evaluations = 0;
+    /// evaluations divided by scoring_seconds
+    double evaluations_per_second = 0;
+
+    unsigned long heap_allocations = 0;
+    unsigned long arena_allocations = 0;
+    unsigned long arena_blocks = 0;
+
+    /// The size of the population at the end of the generation
+    unsigned int population = 0;
+    double mean_size = 0;
+    unsigned int max_size = 0;
+    double mean_depth = 0;
+    unsigned int max_depth = 0;
+
+    double best_fitness = 0;
+    double mean_fitness = 0;
+
+    /// Lookups in the fitness cache, 0 if caching is disabled
+    unsigned long cache_hits = 0;
+    unsigned long cache_misses = 0;
+    double cache_hit_rate = 0;
+
+    /** Calls a function on the name and the value of every field, in
+     * declaration order
+     * \param f A functor whose operator() takes a const char * and a value
+     * of any of the field types */
+    template<typename F>
+    void for_each_field(F &f) const
+    {
+        f("generation", generation);
+        f("selection_seconds", selection_seconds);
+        f("cross_over_seconds", cross_over_seconds);
+        f("populate_seconds", populate_seconds);
+        f("scoring_seconds", scoring_seconds);
+        f("evaluations", evaluations);
+        f("evaluations_per_second", evaluations_per_second);
+        f("heap_allocations", heap_allocations);
+        f("arena_allocations", arena_allocations);
+        f("arena_blocks", arena_blocks);
+        f("population", population);
+        f("mean_size", mean_size);
+        f("max_size", max_size);
+        f("mean_depth", mean_depth);
+        f("max_depth", max_depth);
+        f("best_fitness", best_fitness);
+        f("mean_fitness", mean_fitness);
+        f("cache_hits", cache_hits);
+        f("cache_misses", cache_misses);
+        f("cache_hit_rate", cache_hit_rate);
+    }
+};
+
+/** Fills the size and depth fields of a record, from the sizes and depths
+ * the trees keep up to date
+ * \param population The individuals (shared pointers to trees) */
+template<typename individual_t>
+void measure_shapes(const std::vector<individual_t> &population,
+                    generation_metrics &record)
+{
+    unsigned long total_size = 0;
+    unsigned long total_depth = 0;
+    record.max_size = 0;
+    record.max_depth = 0;
+    for(const individual_t &individual : population)
+    {
+        unsigned int size = individual->get_size();
+        unsigned int depth = individual->get_depth();
+        total_size += size;
+        total_depth += depth;
+        record.max_size = std::max(record.max_size, size);
+        record.max_depth = std::max(record.max_depth, depth);
+    }
+    record.population = population.size();
+    if(!population.empty())
+    {
+        record.mean_size = (double)total_size / population.size();
+        record.mean_depth = (double)total_depth / population.size();
+    }
+}
+
+/** Receiver of the metrics of each generation (see
+ * Optimizer::set_metrics_sink)
+ *
+ * record is called from the thread running the optimizer, at the end of
+ * each generation. */
+class MetricsSink
+{
+    public:
+        virtual ~MetricsSink() {}
+
+        virtual void record(const generation_metrics &metrics) = 0;
+};
+
+/** Writes the metrics as CSV, with a header line before the first record */
+class CsvSink : public MetricsSink
+{
+    private:
+        std::ostream &out;
+        bool header_written = false;
+
+        struct header_writer
+        {
+            std::ostream &out;
+            bool first;
+
+            template<typename V>
+            void operator()(const char *name, const V &)
+            {
+                out << (first ? "" : ",") << name;
+                first = false;
+            }
+        };
+
+        struct value_writer
+        {
+            std::ostream &out;
+            bool first;
+
+            template<typename V>
+            void operator()(const char *, const V &value)
+            {
+                out << (first ? "" : ",") << value;
+                first = false;
+            }
+        };
+
+    public:
+        /** Constructor for CsvSink
+         * \param out The stream written to, which must outlive the sink */
+        explicit CsvSink(std::ostream &out) : out(out) {}
+
+        void record(const generation_metrics &metrics)
+        {
+            if(!header_written)
+            {
+                header_writer header{out, true};
+                metrics.for_each_field(header);
+                out << '\n';
+                header_written = true;
+            }
+            value_writer values{out, true};
+            metrics.for_each_field(values);
+            out << '\n';
+        }
+};
+
+/** Writes the metrics of each generation as one JSON object per line */
+class JsonLinesSink : public MetricsSink
+{
+    private:
+        std::ostream &out;
+
+        struct field_writer
+        {
+            std::ostream &out;
+            bool first;
+
+            template<typename V>
+            void operator()(const char *name, const V &value)
+            {
+                out << (first ? "{\"" : ",\"") << name << "\":" << value;
+                first = false;
+            }
+
+            /// JSON has no infinity nor NaN, they are written as null
+            void operator()(const char *name, double value)
+            {
+                out << (first ? "{\"" : ",\"") << name << "\":";
+                if(std::isfinite(value))
+                    out << value;
+                else
+                    out << "null";
+                first = false;
+            }
+        };
+
+    public:
+        /** Constructor for JsonLinesSink
+         * \param out The stream written to, which must outlive the sink */
+        explicit JsonLinesSink(std::ostream &out) : out(out) {}
+
+        void record(const generation_metrics &metrics)
+        {
+            // Enough digits to read back the exact doubles, such as scores
+            // close to the target fitness
+            std::streamsize precision = out.precision(
+                    std::numeric_limits<double>::max_digits10);
+            field_writer fields{out, true};
+            metrics.for_each_field(fields);
+            out << "}\n";
+            out.precision(precision);
+        }
+};
+
+/** Hands the metrics of each generation to a function */
+class CallbackSink : public MetricsSink
+{
+    private:
+        std::function<void(const generation_metrics&)> callback;
+
+    public:
+        explicit CallbackSink(
+                std::function<void(const generation_metrics&)> callback)
+            : callback(callback) {}
+
+        void record(const generation_metrics &metrics)
+        { callback(metrics); }
+};
@@ -1,232 +1,1415 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
 #include <functional>
-#include <list>
+#include <limits>
+#include <memory>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 #include <tuple>
-#include <random>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "arena.hpp"
+#include "dataset.hpp"
+#include "fitness_cache.hpp"
+#include "flat_tree.hpp"
+#include "hashcons.hpp"
+#include "metrics.hpp"
+#include "random.hpp"
+#include "ring_queue.hpp"
+#include "selection.hpp"
+#include "serialize.hpp"
+#include "thread_pool.hpp"
 #include "tree.hpp"
 
-template<typename T, typename node_type_t>
-using tree_ptr = std::shared_ptr<Tree<T,node_type_t>>;
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t = Tree>
+using tree_ptr = std::shared_ptr<tree_t<T,node_type_t>>;
 
-template<typename T, typename node_type_t>
+/** Access to the private phases of an Optimizer, for the benchmarks
+ *
+ * It is only declared here: a benchmark defines it for the optimizer type
+ * it measures. */
+template<typename optimizer_t>
+struct optimizer_probe;
+
+/** Genetic optimizer over trees
+ *
+ * tree_t is the tree representation used for individuals. It can be Tree
+ * (one heap allocated node per tree node) or FlatTree (one contiguous
+ * array per tree).
+ *
+ * fitness_t is the type of the fitness function, a functor taking an
+ * individual and returning its score. The default std::function accepts
+ * any function but hides it from the compiler: a functor type, such as one
+ * evaluating trees over a PrimitiveSet (see primitives.hpp), lets the whole
+ * evaluation be inlined into the scoring loop.
+ *
+ * When scoring uses several threads (see set_threads), eval_fitness is
+ * called concurrently on different individuals. It must then be safe to
+ * call from several threads at once: it may read shared data, but must
+ * synchronize any shared state it modifies. The individual it is given is
+ * not modified by the optimizer during the call. rand_individual is always
+ * called from the thread running the optimizer.
+ *
+ * All the random numbers of the optimizer are drawn from streams derived
+ * from a single seed (see seed): one stream per phase of each generation.
+ * rand_individual and the selection strategy are given the stream of the
+ * phase they are called in and must not use another source of randomness.
+ * A run with a given seed and generational steps is then reproduced
+ * exactly, whatever the number of scoring threads, and changing the number
+ * of numbers drawn by one phase does not change the others. */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t = Tree,
+         typename fitness_t
+             = std::function<double(tree_ptr<T,node_type_t,tree_t>)>>
 class Optimizer
 {
+    public:
+        typedef tree_ptr<T,node_type_t,tree_t> individual_t;
+
+        template<typename optimizer_t>
+        friend struct optimizer_probe;
+
     private:
-        std::function<double(tree_ptr<T,node_type_t>)> eval_fitness;
-        std::function<tree_ptr<T,node_type_t>(void)> rand_individual;
+        fitness_t eval_fitness;
+        std::function<individual_t(Xoshiro256&)> rand_individual;
+        /// The fitness function evaluating part of the fitness cases, if
+        /// any (see set_partial_fitness)
+        std::function<double(individual_t,const evaluation_request&)>
+            partial_fitness;
+        /// The function simplifying individuals, if any (see
+        /// set_simplifier)
+        std::function<individual_t(const individual_t&)> simplifier;
+        /// Whether the population is simplified before scoring
+        bool simplify_population = false;
 
         const unsigned int max_population;
+        /// The number of cross over operations per generation
+        static const unsigned int cross_overs = 20;
+
+        /// The phases of a generation that draw random numbers
+        enum class phase : unsigned int
+        {
+            initialize,
+            selection,
+            cross_over,
+            populate,
+            scoring,
+            steady_state,
+            count
+        };
+        /// The generator the streams are derived from
+        Xoshiro256 root;
+        /// The stream of the current phase
+        Xoshiro256 gen;
+
+        /// The threads scoring the population, if scoring is parallel
+        std::unique_ptr<ThreadPool> pool;
+
+        /// Whether generations are allocated in arenas
+        bool arenas_enabled = false;
+        /// The arenas of the current and of the next generation
+        Arena arenas[2];
+        /// The index of the arena of the current generation
+        unsigned int active_arena = 0;
+
+        /// The current population, declared after the arenas it lives in
+        std::vector<individual_t> population;
+        /// The scores of the current population, in the same order
+        std::vector<double> scores;
+        /// The number of generations since initialize
+        unsigned int generation = 0;
+
+        /// The scores of recently evaluated trees, if caching is enabled
+        std::unique_ptr<FitnessCache> cache;
+        /// Buffers of compute_scores, kept to reuse their memory
+        std::vector<unsigned int> misses;
+        std::vector<unsigned int> evaluated;
+        std::unordered_map<std::uint64_t,unsigned int> first_miss;
+        /// The canonical nodes of the population, if hash-consing is
+        /// enabled, declared after the arenas they live in
+        std::unique_ptr<NodeStore<T,node_type_t>> store;
+
+        /// A score computed by a worker in steady-state mode
+        struct evaluation
+        {
+            /// The slot of the evaluated individual in in_flight
+            unsigned int slot;
+            double score;
+            std::exception_ptr error;
+        };
+        /// The probability for an offspring of steady-state mode to be a
+        /// new random individual rather than the result of a cross over
+        const double random_rate = 0.25;
+        /// The individuals being evaluated in steady-state mode, by slot
+        std::vector<individual_t> in_flight;
+        std::vector<unsigned int> free_slots;
+        /// The offspring of steady-state mode waiting for a free slot
+        std::vector<individual_t> offspring;
+
+        /// The strategy choosing the survivors of natural selection
+        std::shared_ptr<SelectionStrategy> selection;
+        /// Buffers of natural_selection, kept to reuse their memory
+        std::vector<unsigned int> survivors;
+        std::vector<individual_t> selected;
+        std::vector<double> selected_scores;
+        std::vector<bool> taken;
+        /// The scores minus the parsimony penalty, if any
+        std::vector<double> penalized;
+
+        /// The limits on the offspring of cross over, 0 for none (see
+        /// set_size_limits)
+        unsigned int max_depth = 0;
+        unsigned int max_nodes = 0;
+        /// The penalty per node subtracted from scores by selection
+        double parsimony = 0;
+
+        /// The quantile of the scores used as early abort threshold, 0 if
+        /// early abort is disabled
+        double abort_quantile = 0;
+        /// The fraction of fitness cases used is 1 / subsample_stride
+        unsigned int subsample_stride = 1;
+        /// The number of best individuals scored on every fitness case
+        unsigned int full_candidates = 1;
+        /// The evaluation asked of partial_fitness in this generation
+        evaluation_request request;
+        /// Whether the score of each individual is computed on every
+        /// fitness case, empty if all of them are
+        std::vector<bool> complete;
+        /// Buffers of partial scoring, kept to reuse their memory
+        std::vector<double> sorted_scores;
+        std::vector<unsigned int> candidates;
+
+        /// The file next_generation saves checkpoints to, if any
+        std::string checkpoint_path;
+        /// The number of generations between checkpoints, 0 for none
+        unsigned int checkpoint_interval = 0;
+        /// The binary form of the last checkpoint, kept to reuse its memory
+        std::vector<char> checkpoint_buffer;
+
+        /// Identifies checkpoint files, followed by the format version
+        static const std::uint64_t checkpoint_magic = 0x4b43504750505043ULL;
+        static const std::uint32_t checkpoint_version = 2;
+
+        /// The receiver of the metrics of each generation, if any
+        std::shared_ptr<MetricsSink> metrics;
+        /// The metrics of the generation being run
+        generation_metrics record;
+        /// The end of the previous lap (see lap)
+        std::chrono::steady_clock::time_point lap_start;
+        /// The number of calls to eval_fitness since the optimizer exists
+        unsigned long evaluation_count = 0;
+        /// The counters at the start of the generation being run
+        unsigned long first_evaluation;
+        unsigned long first_heap_allocation;
+        unsigned long first_arena_allocation;
+        unsigned long first_arena_block;
+        unsigned long first_cache_hit;
+        unsigned long first_cache_miss;
+
+        /** Starts the metrics of a generation, nothing is measured
+         * without a sink */
+        void start_metrics()
+        {
+            if(!metrics)
+                return;
+            record = generation_metrics();
+            const allocation_counters &counters = get_allocation_counters();
+            first_evaluation = evaluation_count;
+            first_heap_allocation = counters.heap_allocations;
+            first_arena_allocation = counters.arena_allocations;
+            first_arena_block = counters.arena_blocks;
+            first_cache_hit = cache ? cache->get_hits() : 0;
+            first_cache_miss = cache ? cache->get_misses() : 0;
+            lap_start = std::chrono::steady_clock::now();
+        }
+
+        /** Adds the time elapsed since the previous lap to the duration of
+         * a phase */
+        void lap(double &seconds)
+        {
+            if(!metrics)
+                return;
+            auto now = std::chrono::steady_clock::now();
+            seconds += std::chrono::duration<double>(now - lap_start).count();
+            lap_start = now;
+        }
+
+        /** Completes the metrics of a generation and sends them to the
+         * sink */
+        void finish_metrics()
+        {
+            if(!metrics)
+                return;
+            const allocation_counters &counters = get_allocation_counters();
+            record.generation = generation;
+            record.evaluations = evaluation_count - first_evaluation;
+            if(record.scoring_seconds > 0)
+                record.evaluations_per_second =
+                    record.evaluations / record.scoring_seconds;
+            record.heap_allocations =
+                counters.heap_allocations - first_heap_allocation;
+            record.arena_allocations =
+                counters.arena_allocations - first_arena_allocation;
+            record.arena_blocks = counters.arena_blocks - first_arena_block;
+            measure_shapes(population, record);
+            if(!scores.empty())
+            {
+                record.best_fitness = get_best_fitness(scores);
+                record.mean_fitness =
+                    std::accumulate(scores.begin(), scores.end(), 0.0)
+                    / scores.size();
+            }
+            if(cache)
+            {
+                record.cache_hits = cache->get_hits() - first_cache_hit;
+                record.cache_misses = cache->get_misses() - first_cache_miss;
+                unsigned long lookups = record.cache_hits
+                    + record.cache_misses;
+                if(lookups)
+                    record.cache_hit_rate = (double)record.cache_hits
+                        / lookups;
+            }
+            metrics->record(record);
+        }
+
+        /** Empties the population and reserves the buffers of a run
+         *
+         * The previous population lives in the arenas about to be reset by
+         * start_arenas. */
+        void clear_population()
+        {
+            population.clear();
+            scores.clear();
+            // Cross over adds at most one individual per operation
+            population.reserve(max_population + cross_overs);
+            scores.reserve(max_population + cross_overs);
+            selected.reserve(max_population + cross_overs);
+            selected_scores.reserve(max_population + cross_overs);
+        }
 
-        std::random_device rd;
-        std::mt19937 gen;
-        std::uniform_real_distribution<> dis;
+        /** Prepares the generation arenas for a new run
+         * \return The arena the first generation is allocated in */
+        Arena * start_arenas()
+        {
+            if(store)
+                store->clear();
+            if(!arenas_enabled)
+                return current_arena();
+            arenas[0].reset();
+            arenas[1].reset();
+            active_arena = 0;
+            return &arenas[active_arena];
+        }
 
-        void populate(std::list<tree_ptr<T,node_type_t>> & population)
+        /** Getter for the arena of the current generation */
+        Arena * generation_arena()
+        {
+            if(!arenas_enabled)
+                return current_arena();
+            return &arenas[active_arena];
+        }
+
+        /** Copies the population to the arena of the next generation and
+         * releases the arena of the current one in O(1) */
+        void compact(std::vector<individual_t> &population)
+        {
+            Arena *next = &arenas[1 - active_arena];
+            {
+                arena_scope scope(next);
+                if(store)
+                {
+                    // The copies keep sharing their identical subtrees
+                    store->clear();
+                    for(individual_t &tree : population)
+                        tree = store->copy(tree);
+                }
+                else
+                    for(individual_t &tree : population)
+                        tree = tree->clone();
+            }
+            arenas[active_arena].reset();
+            active_arena = 1 - active_arena;
+            current_arena() = next;
+        }
+
+        /** Copies an individual out of the generation arenas, to the
+         * current arena of the calling thread (the global heap by
+         * default) */
+        individual_t release(const individual_t &tree)
+        {
+            if(!arenas_enabled)
+                return tree;
+            return tree->clone();
+        }
+
+        /** Switches gen to the stream of a phase of the current
+         * generation */
+        void start_phase(phase current)
+        {
+            gen = root.stream((std::uint64_t)generation
+                              * (unsigned int)phase::count
+                              + (unsigned int)current);
+        }
+
+        void populate(std::vector<individual_t> & population)
         {
             while(population.size() < max_population)
+                population.push_back(rand_individual(gen));
+        }
+
+        /** Simplifies the population, if enabled (see set_simplifier) */
+        void simplify(std::vector<individual_t> &population)
+        {
+            if(!simplify_population)
+                return;
+            for(individual_t &individual : population)
+                individual = simplifier(individual);
+        }
+
+        /** Shares the identical subtrees of the population, if enabled
+         * (see use_hash_consing) */
+        void intern(std::vector<individual_t> &population)
+        {
+            if(!store)
+                return;
+            for(individual_t &individual : population)
+                individual = store->intern(individual);
+        }
+
+        /** Scores the population, evaluating only the trees whose hash is
+         * not in the cache, if it is used, and each of them once */
+        void compute_cached_scores(std::vector<individual_t> &population,
+                                   std::vector<double>    &scores)
+        {
+            // misses holds the individuals to evaluate, evaluated[i] the
+            // individual whose score is copied to individual i
+            bool use_cache = cache && request.complete();
+            misses.clear();
+            evaluated.resize(population.size());
+            first_miss.clear();
+            for(unsigned int i = 0; i < population.size(); i++)
             {
-#ifdef VERBOSE
-                std::cout << "|" << std::flush;
-#endif
-                population.push_back(rand_individual());
+                std::uint64_t hash = population[i]->get_hash();
+                evaluated[i] = i;
+                if(use_cache && cache->find(hash, scores[i]))
+                    continue;
+                auto inserted = first_miss.emplace(hash, i);
+                if(inserted.second)
+                    misses.push_back(i);
+                else
+                    evaluated[i] = inserted.first->second;
             }
-#ifdef VERBOSE
-            std::cout << std::endl << population.size() << " trees"
-                << std::endl;
-#endif
+            if(pool)
+                pool->parallel_for(misses.size(), [&](std::size_t i) {
+                    scores[misses[i]] = evaluate(population[misses[i]]);
+                });
+            else
+                for(unsigned int i : misses)
+                    scores[i] = evaluate(population[i]);
+            evaluation_count += misses.size();
+            // Scores below the threshold may be bounds of aborted
+            // evaluations, they are not cached
+            for(unsigned int i : misses)
+                if(use_cache && scores[i] >= request.threshold)
+                    cache->insert(population[i]->get_hash(), scores[i]);
+            for(unsigned int i = 0; i < population.size(); i++)
+                scores[i] = scores[evaluated[i]];
         }
 
-        void compute_scores(std::list<tree_ptr<T,node_type_t>> &population,
+        /** Evaluates an individual, as asked by request if a partial
+         * fitness function is set */
+        double evaluate(const individual_t &individual)
+        {
+            if(partial_fitness)
+                return partial_fitness(individual, request);
+            return eval_fitness(individual);
+        }
+
+        /** Computes the early abort threshold and the subset of fitness
+         * cases of the next scoring
+         *
+         * The threshold is taken from the scores of the current population,
+         * so it must be called before they are replaced. */
+        void plan_scoring()
+        {
+            request = evaluation_request();
+            if(!partial_fitness)
+                return;
+            if(abort_quantile > 0 && !scores.empty())
+            {
+                sorted_scores.assign(scores.begin(), scores.end());
+                auto nth = sorted_scores.begin()
+                    + (std::size_t)(abort_quantile * (scores.size() - 1));
+                std::nth_element(sorted_scores.begin(), nth,
+                                 sorted_scores.end());
+                request.threshold = *nth;
+            }
+            if(subsample_stride > 1)
+            {
+                start_phase(phase::scoring);
+                request.stride = subsample_stride;
+                request.phase = gen.below(subsample_stride);
+            }
+        }
+
+        /** Scores on every fitness case the best individuals whose score
+         * is partial, so that the best individual has an exact score
+         *
+         * A score is partial if it was computed on a subset of the cases,
+         * or if it is below the threshold and may be the bound of an
+         * aborted evaluation. */
+        void complete_best_scores(std::vector<individual_t> &population,
+                                  std::vector<double>    &scores)
+        {
+            complete.clear();
+            if(!partial_fitness || (request.complete()
+                                    && request.threshold
+                                       == -std::numeric_limits<double>::infinity()))
+                return;
+            complete.resize(population.size());
+            for(unsigned int i = 0; i < population.size(); i++)
+                complete[i] = request.complete()
+                    && scores[i] >= request.threshold;
+            candidates.resize(population.size());
+            std::iota(candidates.begin(), candidates.end(), 0);
+            unsigned int count = std::min<std::size_t>(full_candidates,
+                                                       candidates.size());
+            std::partial_sort(candidates.begin(), candidates.begin() + count,
+                    candidates.end(),
+                    [&scores](unsigned int a, unsigned int b) {
+                        return scores[a] > scores[b];
+                    });
+            candidates.resize(count);
+            candidates.erase(std::remove_if(candidates.begin(),
+                        candidates.end(),
+                        [this](unsigned int i) { return complete[i]; }),
+                    candidates.end());
+            auto score = [&](std::size_t i) {
+                scores[candidates[i]] = eval_fitness(population[candidates[i]]);
+            };
+            if(pool)
+                pool->parallel_for(candidates.size(), score);
+            else
+                for(std::size_t i = 0; i < candidates.size(); i++)
+                    score(i);
+            evaluation_count += candidates.size();
+            for(unsigned int i : candidates)
+            {
+                complete[i] = true;
+                if(cache)
+                    cache->insert(population[i]->get_hash(), scores[i]);
+            }
+        }
+
+        void compute_scores(std::vector<individual_t> &population,
                             std::vector<double>    &scores)
         {
-            std::vector<double> new_scores;
-            for(tree_ptr<T,node_type_t> tree : population)
+            scores.resize(population.size());
+            // Scores of subsets of the cases change at each generation, so
+            // they are not cached, but identical trees of a generation
+            // still get the same score
+            if((cache && request.complete()) || store)
+                compute_cached_scores(population, scores);
+            else
             {
-#ifdef VERBOSE
-                std::cout << "|" << std::flush;
-#endif
-                new_scores.push_back(eval_fitness(tree));
+                evaluation_count += population.size();
+                // Each call writes its own slot, so scores stay in the
+                // order of the population
+                if(pool)
+                    pool->parallel_for(population.size(), [&](std::size_t i) {
+                        scores[i] = evaluate(population[i]);
+                    });
+                else
+                    for(unsigned int i = 0; i < population.size(); i++)
+                        scores[i] = evaluate(population[i]);
             }
-#ifdef VERBOSE
-            std::cout << std::endl;
-#endif
-            scores = new_scores;
+            complete_best_scores(population, scores);
         }
 
-        void natural_selection(std::list<tree_ptr<T,node_type_t>> &population,
+        /** Getter for the score of an individual as seen by selection,
+         * lowered by the parsimony penalty */
+        double selection_score(const std::vector<individual_t> &population,
+                               const std::vector<double> &scores,
+                               unsigned int index) const
+        { return scores[index] - parsimony * population[index]->get_size(); }
+
+        void natural_selection(std::vector<individual_t> &population,
                                std::vector<double>    &scores)
         {
-            double max_score = get_best_fitness(scores);
-            std::list<tree_ptr<T,node_type_t>> new_population;
-#ifdef VERBOSE
-            std::cout << scores.size() << std::endl;
-#endif
-            while(new_population.size() == 0) // In case all population dies
-            {
-                unsigned int i = 0;
-#ifdef VERBOSE
-                std::cout << "|" << std::flush;
-#endif
-                for(tree_ptr<T,node_type_t> tree : population)
+            if(parsimony > 0)
+            {
+                penalized.resize(scores.size());
+                for(unsigned int i = 0; i < scores.size(); i++)
+                    penalized[i] = selection_score(population, scores, i);
+                // Penalties are not bounded, while BernoulliSelection needs
+                // scores above -1: negative scores are shifted so that the
+                // lowest one is 0, which keeps their order
+                auto lowest = std::min_element(penalized.begin(),
+                                               penalized.end());
+                if(lowest != penalized.end() && *lowest < 0)
                 {
-                    double probability = (scores[i] + 1) / (max_score + 1);
-                    if(dis(gen) < probability)
-                        new_population.push_back(tree);
-                    i++;
+                    double shift = -*lowest;
+                    for(double &score : penalized)
+                        score += shift;
                 }
+                selection->select(penalized, gen, survivors);
+            }
+            else
+            {
+                selection->select(scores, gen, survivors);
             }
-#ifdef VERBOSE
-            std::cout << std::endl << new_population.size() << " trees kept"
-                << std::endl;
-#endif
-            population = new_population;
+            // The root of an individual selected several times is copied,
+            // since cross over modifies roots in place. Subtrees are shared.
+            selected.clear();
+            selected_scores.clear();
+            taken.assign(population.size(), false);
+            for(unsigned int index : survivors)
+            {
+                if(taken[index])
+                    selected.push_back(make_tree<tree_t<T,node_type_t>>(
+                                *population[index]));
+                else
+                    selected.push_back(population[index]);
+                selected_scores.push_back(scores[index]);
+                taken[index] = true;
+            }
+            population.swap(selected);
+            scores.swap(selected_scores);
+            // Dead individuals are destroyed here, before their arena is
+            // reset by compact
+            selected.clear();
+            if(arenas_enabled)
+                compact(population);
         }
 
-        void _cross_over(std::list<tree_ptr<T,node_type_t>> &population)
+        /** Makes an individual the only owner of its root, so that it can
+         * be modified in place
+         *
+         * Roots can be shared with other individuals, as a root or as a
+         * subtree, after a cross over. Only the root is copied, replace
+         * takes care of the shared nodes below it.
+         * \return The individual */
+        individual_t & own(std::vector<individual_t> &population,
+                           unsigned int index)
+        {
+            if(population[index].use_count() > 1)
+                population[index] =
+                    make_tree<tree_t<T,node_type_t>>(*population[index]);
+            return population[index];
+        }
+
+        /** Checks that replacing a subtree of a tree gives a tree within
+         * the size limits
+         *
+         * The depth is checked along the replaced branch only, so trees
+         * within the limits stay within them.
+         * \param tree The tree to modify
+         * \param position The position of the replaced subtree
+         * \param removed The replaced subtree
+         * \param inserted The tree replacing it */
+        bool fits(const individual_t &tree, const pos &position,
+                  const individual_t &removed,
+                  const individual_t &inserted) const
+        {
+            if(max_nodes && tree->get_size() - removed->get_size()
+                            + inserted->get_size() > max_nodes)
+                return false;
+            if(max_depth && position.size() + inserted->get_depth()
+                            > max_depth)
+                return false;
+            return true;
+        }
+
+        void _cross_over(std::vector<individual_t> &population)
         {
             unsigned int n = population.size();
             std::pair<bool,pos> result;
-            tree_ptr<T,node_type_t> tree1, tree2;
-            pos pos1, pos2;
+            unsigned int ind1, ind2;
+            pos pos1;
 
             do
             {
-                unsigned int ind1 = (unsigned int)(dis(gen) * n);
-                unsigned int ind2 = (unsigned int)(dis(gen) * n);
+                ind1 = gen.below(n);
+                ind2 = gen.below(n);
 
-                tree1 = *std::next(population.begin(), ind1);
-                pos1 = tree1->random_position();
+                const tree_t<T,node_type_t> &tree1 = *population[ind1];
+                pos1 = tree1.random_position(gen);
                 node_type_t type;
-                if(pos1.size() == 0)
-                    type = tree1->get_type();
+                if(pos1.empty())
+                    type = tree1.get_type();
                 else
-                    type = tree1->get_subtree(pos1)->get_type();
+                    type = tree1.get_subtree(pos1)->get_type();
 
-                tree2 = *std::next(population.begin(), ind2);
-                result = tree2->random_position(type);
+                result = population[ind2]->random_position(type, gen);
             } while(!result.first);
-            pos2 = result.second;
-            tree_ptr<T,node_type_t> subtree1, subtree2;
-            if(pos1.size() == 0)
+            // Positions drawn in one tree are invalidated by the first
+            // replacement if both parents are the same individual
+            if(ind1 == ind2)
+                return;
+            const pos &pos2 = result.second;
+            individual_t subtree1, subtree2;
+            if(pos1.empty())
             {
-                if(pos2.size() == 0)
+                if(pos2.empty())
                     return;
-                subtree2 = tree2->get_subtree(pos2);
+                subtree2 = population[ind2]->get_subtree(pos2);
+                if(!fits(population[ind2], pos2, subtree2, population[ind1]))
+                    return;
+                own(population, ind2)->replace(population[ind1], pos2);
                 population.push_back(subtree2);
-                tree2->replace(tree1, pos2);
             }
             else
             {
-                subtree1 = tree1->get_subtree(pos1);
-                if(pos2.size() == 0)
+                subtree1 = population[ind1]->get_subtree(pos1);
+                if(pos2.empty())
                 {
+                    if(!fits(population[ind1], pos1, subtree1,
+                             population[ind2]))
+                        return;
+                    own(population, ind1)->replace(population[ind2], pos1);
                     population.push_back(subtree1);
-                    tree1->replace(tree2, pos1);
                     return;
                 }
-                subtree2 = tree2->get_subtree(pos2);
-                tree1->replace(subtree2, pos1);
-                tree2->replace(subtree1, pos2);
+                subtree2 = population[ind2]->get_subtree(pos2);
+                // An offspring exceeding the limits stays its parent
+                bool fits1 = fits(population[ind1], pos1, subtree1, subtree2);
+                bool fits2 = fits(population[ind2], pos2, subtree2, subtree1);
+                if(fits1)
+                    own(population, ind1)->replace(subtree2, pos1);
+                if(fits2)
+                    own(population, ind2)->replace(subtree1, pos2);
             }
         }
 
-        void cross_over(std::list<tree_ptr<T,node_type_t>> &population)
+        /** Picks the better of two random individuals */
+        unsigned int tournament()
+        {
+            unsigned int n = population.size();
+            unsigned int ind1 = gen.below(n);
+            unsigned int ind2 = gen.below(n);
+            return selection_score(population, scores, ind1)
+                >= selection_score(population, scores, ind2) ? ind1 : ind2;
+        }
+
+        /** Produces offspring for steady-state mode, without modifying the
+         * population
+         *
+         * Children start as copies of the roots of their parents, so cross
+         * over only copies the nodes on the replaced path and the parents,
+         * which workers may be reading, are left untouched.
+         * \param offspring The vector the new individuals are appended to */
+        void breed(std::vector<individual_t> &offspring)
         {
-            for(unsigned int i = 0; i < 20; i++)
+            if(gen.uniform() < random_rate)
             {
-#ifdef VERBOSE
-                std::cout << "|" << std::flush;
-#endif
-                _cross_over(population);
+                offspring.push_back(rand_individual(gen));
+                return;
             }
-#ifdef VERBOSE
-            std::cout << std::endl;
-#endif
+            const individual_t &parent1 = population[tournament()];
+            const individual_t &parent2 = population[tournament()];
+            pos pos1 = parent1->random_position(gen);
+            node_type_t type;
+            if(pos1.empty())
+                type = parent1->get_type();
+            else
+                type = parent1->get_subtree(pos1)->get_type();
+            std::pair<bool,pos> result = parent2->random_position(type, gen);
+            if(!result.first || parent1 == parent2
+               || (pos1.empty() && result.second.empty()))
+            {
+                offspring.push_back(rand_individual(gen));
+                return;
+            }
+            const pos &pos2 = result.second;
+            // Offspring exceeding the size limits are dropped
+            std::size_t before = offspring.size();
+            if(pos1.empty())
+            {
+                individual_t subtree2 = parent2->get_subtree(pos2);
+                if(fits(parent2, pos2, subtree2, parent1))
+                {
+                    auto child = make_tree<tree_t<T,node_type_t>>(*parent2);
+                    child->replace(parent1, pos2);
+                    offspring.push_back(child);
+                    offspring.push_back(subtree2);
+                }
+            }
+            else if(pos2.empty())
+            {
+                individual_t subtree1 = parent1->get_subtree(pos1);
+                if(fits(parent1, pos1, subtree1, parent2))
+                {
+                    auto child = make_tree<tree_t<T,node_type_t>>(*parent1);
+                    child->replace(parent2, pos1);
+                    offspring.push_back(child);
+                    offspring.push_back(subtree1);
+                }
+            }
+            else
+            {
+                individual_t subtree1 = parent1->get_subtree(pos1);
+                individual_t subtree2 = parent2->get_subtree(pos2);
+                if(fits(parent1, pos1, subtree1, subtree2))
+                {
+                    auto child1 = make_tree<tree_t<T,node_type_t>>(*parent1);
+                    child1->replace(subtree2, pos1);
+                    offspring.push_back(child1);
+                }
+                if(fits(parent2, pos2, subtree2, subtree1))
+                {
+                    auto child2 = make_tree<tree_t<T,node_type_t>>(*parent2);
+                    child2->replace(subtree1, pos2);
+                    offspring.push_back(child2);
+                }
+            }
+            if(offspring.size() == before)
+                offspring.push_back(rand_individual(gen));
         }
 
-        void step(std::list<tree_ptr<T,node_type_t>> &population,
+        /** Inserts a scored offspring in steady-state mode, in place of the
+         * worst individual if it is not better than the offspring */
+        void insert(const individual_t &child, double score)
+        {
+            auto worst = std::min_element(scores.begin(), scores.end());
+            if(score < *worst)
+                return;
+            unsigned int index = std::distance(scores.begin(), worst);
+            population[index] = child;
+            scores[index] = score;
+        }
+
+        void cross_over(std::vector<individual_t> &population)
+        {
+            for(unsigned int i = 0; i < cross_overs; i++)
+                _cross_over(population);
+        }
+
+        void step(std::vector<individual_t> &population,
                   std::vector<double>    &scores)
         {
-#ifdef VERBOSE
-            std::cout << "naturally selecting..." << std::endl;
-#endif
+            start_metrics();
+            plan_scoring();
+            start_phase(phase::selection);
             natural_selection(population, scores);
-#ifdef VERBOSE
-            std::cout << "crossing over..." << std::endl;
-#endif
+            lap(record.selection_seconds);
+            start_phase(phase::cross_over);
             cross_over(population);
-#ifdef VERBOSE
-            std::cout << "populating..." << std::endl;
-#endif
+            lap(record.cross_over_seconds);
+            start_phase(phase::populate);
             populate(population);
-#ifdef VERBOSE
-            std::cout << "computing scores..." << std::endl;
-#endif
+            simplify(population);
+            intern(population);
+            lap(record.populate_seconds);
             compute_scores(population, scores);
-#ifdef VERBOSE
-            std::cout << std::endl;
-#endif
+            lap(record.scoring_seconds);
         }
 
-        tree_ptr<T,node_type_t> get_best(std::list<tree_ptr<T,node_type_t>> &population,
-                             std::vector<double>    &scores)
+        /** Getter for the index of the best individual, among the ones
+         * scored on every fitness case when scores can be partial */
+        unsigned int best_index(const std::vector<double> &scores) const
         {
-            auto max_score = std::max_element(scores.begin(),
-                                              scores.end());
-            unsigned int index = std::distance(scores.begin(), max_score);
-            return *std::next(population.begin(), index);
+            unsigned int best = 0;
+            bool found = false;
+            for(unsigned int i = 0; i < scores.size(); i++)
+            {
+                if(!complete.empty() && !complete[i])
+                    continue;
+                if(!found || scores[i] > scores[best])
+                    best = i;
+                found = true;
+            }
+            return best;
         }
 
+        individual_t get_best(std::vector<individual_t> &population,
+                             std::vector<double>    &scores)
+        { return population[best_index(scores)]; }
+
         double get_best_fitness(std::vector<double> &scores)
-        {
-            return *std::max_element(scores.begin(), scores.end());
-        }
+        { return scores[best_index(scores)]; }
 
     public:
-        Optimizer(std::function<double(tree_ptr<T,node_type_t>)> eval_fitness,
-                  std::function<tree_ptr<T,node_type_t>(void)> rand_individual,
-                  unsigned int max_population = 100)
+        /** Constructor for Optimizer
+         * \param eval_fitness The fitness function, higher is better
+         * \param rand_individual The generator of random individuals
+         * \param max_population The size of the population
+         * \param selection The strategy choosing the survivors of each
+         * generation (see selection.hpp) */
+        Optimizer(fitness_t eval_fitness,
+                  std::function<individual_t(Xoshiro256&)> rand_individual,
+                  unsigned int max_population = 100,
+                  std::shared_ptr<SelectionStrategy> selection
+                      = std::make_shared<BernoulliSelection>())
             : eval_fitness(eval_fitness), rand_individual(rand_individual),
             max_population(max_population),
-            gen(rd()), dis(0,1)
+            root(random_seed()), selection(selection)
         {}
 
-        tree_ptr<T,node_type_t> run(unsigned int steps = 10)
+        /** Constructor for Optimizer doing symbolic regression over a
+         * dataset
+         *
+         * The fitness of a tree is computed by DatasetFitness: the tree is
+         * compiled and run over the rows of the dataset, chunk by chunk.
+         * \param data The fitness cases
+         * \param encode A function returning the instruction<value_t> of
+         * the value of type T attached to a node (see compile)
+         * \param rand_individual The generator of random individuals
+         * \param max_population The size of the population
+         * \param selection The strategy choosing the survivors of each
+         * generation (see selection.hpp) */
+        template<typename value_t, typename encoder_t>
+        Optimizer(std::shared_ptr<MappedDataset<value_t>> data,
+                  encoder_t encode,
+                  std::function<individual_t(Xoshiro256&)> rand_individual,
+                  unsigned int max_population = 100,
+                  std::shared_ptr<SelectionStrategy> selection
+                      = std::make_shared<BernoulliSelection>())
+            : Optimizer(DatasetFitness<value_t,encoder_t>(data, encode),
+                        rand_individual, max_population, selection)
+        { partial_fitness = DatasetFitness<value_t,encoder_t>(data, encode); }
+
+        /** Seeds the random number generators of the optimizer
+         *
+         * Runs of the generational loop (run, run_until_fitness,
+         * next_generation) with the same seed and a deterministic fitness
+         * function are identical, whatever the number of threads. With
+         * several threads, run_async breeds offspring in the order their
+         * evaluations finish, which varies between runs.
+         * \param value The seed */
+        void seed(std::uint64_t value) { root.seed(value); }
+
+        /** Getter for the seed of the optimizer, drawn from
+         * std::random_device unless seed was called */
+        std::uint64_t get_seed() const { return root.get_seed(); }
+
+        /** Makes the optimizer allocate the trees of each generation in an
+         * Arena
+         *
+         * Two arenas are used alternately: survivors of natural selection
+         * are copied to the arena of the next generation, and the arena of
+         * the previous generation is then released as a whole. The returned
+         * best individual is copied out of the arenas.
+         * \param enable Whether arenas are used */
+        void use_arenas(bool enable = true) { arenas_enabled = enable; }
+
+        /** Sets the number of threads scoring the population
+         *
+         * The threads are kept in a work-stealing ThreadPool for the
+         * lifetime of the optimizer. See the class documentation for the
+         * requirements on eval_fitness.
+         * \param threads The number of threads, 0 for one per hardware
+         * thread and 1 to score on the calling thread only */
+        void set_threads(unsigned int threads)
+        {
+            if(threads == 0)
+                threads = std::thread::hardware_concurrency();
+            if(threads <= 1)
+                pool.reset();
+            else
+                pool.reset(new ThreadPool(threads - 1));
+        }
+
+        /** Makes the optimizer cache fitness scores
+         *
+         * Scores are cached by structural hash of the trees (see
+         * Tree::get_hash), so survivors of natural selection and trees
+         * identical to recently evaluated ones are not evaluated again.
+         * eval_fitness must then only depend on the structure of the tree.
+         * \param capacity The maximum number of cached scores, least
+         * recently used scores are evicted first. 0 disables the cache. */
+        void use_fitness_cache(std::size_t capacity = 4096)
+        {
+            if(capacity == 0)
+                cache.reset();
+            else
+                cache.reset(new FitnessCache(capacity));
+        }
+
+        /** Makes the optimizer share the identical subtrees of the
+         * population (hash-consing, see NodeStore)
+         *
+         * Offspring are interned after each cross over, so a subtree
+         * common to many individuals is stored once, whether it was
+         * inherited or rebuilt, and identical individuals of a generation
+         * are evaluated once even without a fitness cache. eval_fitness
+         * must then only depend on the structure of the tree. Interning
+         * only applies to Tree individuals, and to step rather than
+         * run_async.
+         * \param enable Whether hash-consing is used */
+        void use_hash_consing(bool enable = true)
+        {
+            if(!enable)
+                store.reset();
+            else if(!store)
+                store.reset(new NodeStore<T,node_type_t>());
+        }
+
+        /** Getter for the node store, to read its hit count
+         * \return The store, nullptr if hash-consing is disabled */
+        const NodeStore<T,node_type_t> * get_node_store() const
+        { return store.get(); }
+
+        /** Getter for the fitness cache, to read its hit rate
+         * \return The cache, nullptr if caching is disabled */
+        const FitnessCache * get_fitness_cache() const { return cache.get(); }
+
+        /** Sets a fitness function able to evaluate part of the fitness
+         * cases, used by early abort and subsampling
+         *
+         * The optimizer constructed around a dataset sets one. The score of
+         * a complete evaluation_request must be the one of eval_fitness.
+         * \param fitness The function, called like eval_fitness */
+        void set_partial_fitness(
+                std::function<double(individual_t,const evaluation_request&)>
+                    fitness)
+        { partial_fitness = fitness; }
+
+        /** Makes evaluations stop as soon as an individual is known to
+         * score below a quantile of the scores of the previous generation
+         *
+         * The score of an aborted evaluation is an upper bound of its real
+         * score, which is enough for selection to drop it most of the time.
+         * The best individuals are always scored exactly, so best,
+         * best_fitness and run_until_fitness are not affected. This needs
+         * a partial fitness function (see set_partial_fitness).
+         * \param quantile The fraction of the previous population scoring
+         * below the threshold, 0 disables early abort */
+        void use_early_abort(double quantile = 0.5)
+        { abort_quantile = std::min(std::max(quantile, 0.0), 1.0); }
+
+        /** Makes each generation score the population on a different
+         * subset of the fitness cases
+         *
+         * The subset is drawn at each generation from interleaved blocks
+         * of cases, so that all individuals of a generation are compared
+         * on the same cases. The best candidates are then scored on every
+         * case: best and best_fitness only consider individuals scored
+         * exactly. The fitness cache is not used for partial scores. This
+         * needs a partial fitness function (see set_partial_fitness).
+         * \param stride One block of cases out of stride is used, 1
+         * disables subsampling
+         * \param candidates The number of best individuals scored on every
+         * case at each generation */
+        void use_subsampling(unsigned int stride, unsigned int candidates = 1)
+        {
+            subsample_stride = stride ? stride : 1;
+            full_candidates = candidates ? candidates : 1;
+        }
+
+        /** Limits the size of the offspring of cross over
+         *
+         * A cross over whose offspring would exceed a limit leaves the
+         * parent unchanged instead. Random individuals are not checked,
+         * their generator has to respect the limits (see generate.hpp).
+         * \param depth The maximal number of levels, 0 for no limit
+         * \param nodes The maximal number of nodes, 0 for no limit */
+        void set_size_limits(unsigned int depth, unsigned int nodes)
+        {
+            max_depth = depth;
+            max_nodes = nodes;
+        }
+
+        /** Makes selection favor small individuals
+         *
+         * Selection compares the scores minus coefficient times the
+         * number of nodes, shifted so that none is negative. The scores
+         * themselves, and thus best and best_fitness, are not changed.
+         *
+         * With scores in [0, 1], as the bundled fitness functions give,
+         * the coefficient should stay below 1 / max_nodes (see
+         * set_size_limits), typically 0.001 to 0.01: the penalty of the
+         * largest trees then stays below the range of the scores, while a
+         * larger coefficient makes selection favor size over fitness.
+         * \param coefficient The penalty per node, 0 to disable */
+        void use_parsimony(double coefficient)
+        { parsimony = coefficient > 0 ? coefficient : 0; }
+
+        /** Sets a function simplifying individuals (see rewrite.hpp)
+         *
+         * The best individual is always simplified. Simplifying the
+         * population makes each generation simplify the new individuals
+         * before scoring them, so that evaluation costs follow what
+         * individuals compute rather than their size. The time spent is
+         * reported as populating. The simplified individuals must score as
+         * the original ones.
+         * \param simplify The function, nullptr to disable simplification
+         * \param population Whether to simplify the population as well */
+        void set_simplifier(
+                std::function<individual_t(const individual_t&)> simplify,
+                bool population = true)
         {
-            std::list<tree_ptr<T,node_type_t>> population;
-            std::vector<double>    scores;
+            simplifier = simplify;
+            simplify_population = simplify && population;
+        }
+
+        /** Makes the optimizer record metrics for each generation
+         *
+         * Phases are timed and the population is measured only while a
+         * sink is set: without one, the optimizer only counts its calls to
+         * the fitness function. Measuring the population visits every
+         * node, which can be noticeable with fast fitness functions.
+         * \param sink The receiver of the metrics (see metrics.hpp),
+         * nullptr to stop recording */
+        void set_metrics_sink(std::shared_ptr<MetricsSink> sink)
+        { metrics = sink; }
+
+        /** Creates and scores a new random population, replacing the
+         * current one */
+        void initialize()
+        {
+            clear_population();
+            arena_scope scope(start_arenas());
+            generation = 0;
+            start_metrics();
+            plan_scoring();
+            start_phase(phase::initialize);
             populate(population);
+            simplify(population);
+            intern(population);
+            lap(record.populate_seconds);
             compute_scores(population, scores);
+            lap(record.scoring_seconds);
+            finish_metrics();
+        }
+
+        /** Runs one generation: natural selection, cross over, populating
+         * and scoring */
+        void next_generation()
+        {
+            arena_scope scope(generation_arena());
+            step(population, scores);
+            generation++;
+            finish_metrics();
+            if(checkpoint_interval && generation % checkpoint_interval == 0)
+                save(checkpoint_path);
+        }
+
+        /** Saves the state of the optimizer to a file
+         *
+         * The population, the scores and whether each of them is exact,
+         * the seed and the generation counter are written in binary form (see serialize.hpp, T and node_type_t
+         * need a serial_traits). Since random numbers are drawn from
+         * streams of the seed and of the generation, a run resumed from a
+         * checkpoint draws the same numbers as the run that saved it. The
+         * file is replaced atomically, a crash while saving leaves the
+         * previous checkpoint.
+         * \param path The path of the file
+         * \throw std::runtime_error If the file cannot be written */
+        void save(const std::string &path)
+        {
+            std::vector<char> &buffer = checkpoint_buffer;
+            buffer.clear();
+            serial_append(buffer, (std::uint64_t)checkpoint_magic);
+            serial_append(buffer, (std::uint32_t)checkpoint_version);
+            serial_append(buffer,
+                          (std::uint32_t)serial_node<T,node_type_t>::bytes);
+            serial_append(buffer, root.get_seed());
+            serial_append(buffer, (std::uint32_t)generation);
+            serial_append(buffer, (std::uint32_t)population.size());
+            for(double score : scores)
+                serial_append(buffer, score);
+            // Whether each score is exact, since early abort and
+            // subsampling leave partial scores
+            for(unsigned int i = 0; i < scores.size(); i++)
+                serial_append(buffer, (std::uint8_t)(complete.empty()
+                                                     || complete[i]));
+            for(const individual_t &individual : population)
+                write_tree(buffer, *individual);
+            write_file_atomically(path, buffer);
+        }
+
+        /** Restores the state saved by save, replacing the current
+         * population
+         *
+         * Continue the run with resume or resume_until_fitness.
+         * \param path The path of the file
+         * \throw std::runtime_error If the file cannot be read or was not
+         * written by an optimizer with the same T and node_type_t */
+        void load(const std::string &path)
+        {
+            MappedFile file(path);
+            const char *in = file.begin();
+            const char *end = file.end();
+            if(serial_extract<std::uint64_t>(in, end) != checkpoint_magic
+               || serial_extract<std::uint32_t>(in, end)
+                  != checkpoint_version
+               || serial_extract<std::uint32_t>(in, end)
+                  != serial_node<T,node_type_t>::bytes)
+                throw std::runtime_error(path + " is not a checkpoint of "
+                                         "this optimizer");
+            std::uint64_t seed = serial_extract<std::uint64_t>(in, end);
+            std::uint32_t saved_generation =
+                serial_extract<std::uint32_t>(in, end);
+            std::uint32_t count = serial_extract<std::uint32_t>(in, end);
+            if(count == 0)
+                throw std::runtime_error(path + " has no population");
+
+            clear_population();
+            arena_scope scope(start_arenas());
+            for(std::uint32_t i = 0; i < count; i++)
+                scores.push_back(serial_extract<double>(in, end));
+            complete.clear();
+            for(std::uint32_t i = 0; i < count; i++)
+                complete.push_back(serial_extract<std::uint8_t>(in, end) != 0);
+            if(std::find(complete.begin(), complete.end(), false)
+               == complete.end())
+                complete.clear();
+            for(std::uint32_t i = 0; i < count; i++)
+                population.push_back(read_tree<T,node_type_t,tree_t>(in, end));
+            root.seed(seed);
+            generation = saved_generation;
+        }
+
+        /** Makes next_generation save a checkpoint periodically
+         * \param path The file the checkpoints are saved to
+         * \param interval The number of generations between checkpoints,
+         * 0 to stop saving them */
+        void checkpoint(const std::string &path, unsigned int interval)
+        {
+            checkpoint_path = path;
+            checkpoint_interval = interval;
+        }
+
+        /** Getter for the number of generations since initialize */
+        unsigned int get_generation() const { return generation; }
+
+        /** Getter for the best individual of the current population,
+         * simplified if a simplifier is set
+         * \return A copy of the individual if arenas are used, the
+         * individual itself otherwise */
+        individual_t best()
+        {
+            individual_t individual = release(get_best(population, scores));
+            return simplifier ? simplifier(individual) : individual;
+        }
+
+        /** Getter for the best score of the current population */
+        double best_fitness() { return get_best_fitness(scores); }
+
+        /** Copies the best individuals of the current population
+         *
+         * The copies do not share any node with the population, so they can
+         * be handed to another thread.
+         * \param count The number of individuals to copy
+         * \return The copies, paired with their scores, best first */
+        std::vector<std::pair<individual_t,double>> elite(unsigned int count)
+        {
+            std::vector<std::pair<individual_t,double>> result;
+            for(unsigned int i = 0; i < population.size(); i++)
+                result.push_back(std::make_pair(population[i], scores[i]));
+            if(count > result.size())
+                count = result.size();
+            std::partial_sort(result.begin(), result.begin() + count,
+                    result.end(),
+                    [](const std::pair<individual_t,double> &a,
+                       const std::pair<individual_t,double> &b) {
+                        return a.second > b.second;
+                    });
+            result.resize(count);
+            for(auto &migrant : result)
+                migrant.first = migrant.first->clone();
+            return result;
+        }
+
+        /** Replaces the worst individuals of the current population by
+         * copies of the given ones
+         * \param migrants The individuals to insert, with their scores */
+        void immigrate(
+                const std::vector<std::pair<individual_t,double>> &migrants)
+        {
+            arena_scope scope(generation_arena());
+            std::vector<unsigned int> order(scores.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(),
+                    [this](unsigned int a, unsigned int b) {
+                        return scores[a] < scores[b];
+                    });
+            for(unsigned int i = 0; i < migrants.size() && i < order.size(); i++)
+            {
+                population[order[i]] = migrants[i].first->clone();
+                scores[order[i]] = migrants[i].second;
+                // The score of a migrant may be partial
+                if(!complete.empty())
+                    complete[order[i]] = false;
+            }
+        }
+
+        individual_t run(unsigned int steps = 10)
+        {
+            initialize();
+            return resume(steps);
+        }
+
+        /** Runs generations from the current population, for instance
+         * after load
+         * \param steps The number of generations to run
+         * \return The best individual */
+        individual_t resume(unsigned int steps)
+        {
             for(unsigned int i = 0; i < steps; i++)
             {
-                std::cout << "\rSTEP " << i + 1 << std::flush;
-                step(population, scores);
+                std::cout << "\rSTEP " << generation + 1 << std::flush;
+                next_generation();
             }
             std::cout << std::endl;
-            return get_best(population, scores);
+            return best();
         }
 
-        tree_ptr<T,node_type_t> run_until_fitness(double target_fitness)
+        individual_t run_until_fitness(double target_fitness)
         {
-            std::list<tree_ptr<T,node_type_t>> population;
-            std::vector<double>    scores;
-            populate(population);
-            compute_scores(population, scores);
-            unsigned int i = 0;
-            while(get_best_fitness(scores) < target_fitness)
+            initialize();
+            return resume_until_fitness(target_fitness);
+        }
+
+        /** Runs generations from the current population until the best
+         * score reaches a target, for instance after load
+         * \param target_fitness The score to reach
+         * \return The best individual */
+        individual_t resume_until_fitness(double target_fitness)
+        {
+            while(best_fitness() < target_fitness)
             {
-                std::cout << "\rSTEP " << i + 1 << std::flush;
-                step(population, scores);
-                i++;
+                std::cout << "\rSTEP " << generation + 1 << std::flush;
+                next_generation();
             }
             std::cout << std::endl;
-            return get_best(population, scores);
+            return best();
         }
-};
 
+        /** Runs the optimizer in asynchronous steady-state mode
+         *
+         * There are no generations: offspring are bred one cross over at a
+         * time and submitted to the worker threads (see set_threads) as
+         * soon as they exist. Each finished evaluation is sent back
+         * through a lock-free queue and the offspring replaces the worst
+         * individual of the population, unless it is worse. Breeding uses
+         * tournaments on the scores known so far, so slow evaluations never
+         * hold the other workers back. Without threads, offspring are
+         * evaluated as soon as they are bred.
+         *
+         * get_generation counts one generation per max_population
+         * evaluated offspring, and metrics are recorded at the same pace:
+         * the time spent breeding is reported as cross over, the rest as
+         * scoring. Arenas, early abort and subsampling are not used in
+         * this mode.
+         * \param evaluations The number of offspring to evaluate
+         * \param target_fitness The score at which to stop early
+         * \return The best individual */
+        individual_t run_async(unsigned long evaluations,
+                double target_fitness
+                    = std::numeric_limits<double>::infinity())
+        {
+            initialize();
+            complete.clear();
+            arena_scope scope(nullptr);
+            // Offspring are bred in the order evaluations finish, so the
+            // whole run draws from one stream
+            start_phase(phase::steady_state);
+            start_metrics();
+            // Enough evaluations in flight for every worker to have one
+            // waiting in its queue
+            unsigned int slots = pool ? 2 * pool->size() : 1;
+            RingQueue<evaluation> finished(slots);
+            in_flight.assign(slots, individual_t());
+            free_slots.resize(slots);
+            std::iota(free_slots.begin(), free_slots.end(), 0);
+            offspring.clear();
+
+            unsigned long bred = 0;
+            unsigned long completed = 0;
+            bool stopping = best_fitness() >= target_fitness;
+            std::exception_ptr error;
+            while(true)
+            {
+                while(!stopping && bred < evaluations && !free_slots.empty())
+                {
+                    if(offspring.empty())
+                    {
+                        lap(record.scoring_seconds);
+                        breed(offspring);
+                        lap(record.cross_over_seconds);
+                    }
+                    individual_t child = offspring.back();
+                    offspring.pop_back();
+                    if(simplify_population)
+                        child = simplifier(child);
+                    bred++;
+                    double score;
+                    if(cache && cache->find(child->get_hash(), score))
+                    {
+                        insert(child, score);
+                        continue;
+                    }
+                    unsigned int slot = free_slots.back();
+                    free_slots.pop_back();
+                    in_flight[slot] = child;
+                    auto task = [this, &finished, slot]() {
+                        evaluation result;
+                        result.slot = slot;
+                        try
+                        {
+                            result.score = eval_fitness(in_flight[slot]);
+                        }
+                        catch(...)
+                        {
+                            result.error = std::current_exception();
+                        }
+                        // There are never more results than slots
+                        finished.push(result);
+                    };
+                    if(pool)
+                        pool->submit(task);
+                    else
+                        task();
+                }
 
+                evaluation result;
+                if(finished.pop(result))
+                {
+                    individual_t child;
+                    child.swap(in_flight[result.slot]);
+                    free_slots.push_back(result.slot);
+                    if(result.error)
+                    {
+                        error = result.error;
+                        stopping = true;
+                        continue;
+                    }
+                    if(cache)
+                        cache->insert(child->get_hash(), result.score);
+                    insert(child, result.score);
+                    evaluation_count++;
+                    if(++completed % max_population == 0)
+                    {
+                        lap(record.scoring_seconds);
+                        generation++;
+                        finish_metrics();
+                        start_metrics();
+                        std::cout << "\rSTEP " << generation << std::flush;
+                    }
+                    if(result.score >= target_fitness)
+                        stopping = true;
+                    continue;
+                }
+                if(free_slots.size() == slots
+                   && (stopping || bred >= evaluations))
+                    break;
+                // Nothing finished yet: run queued evaluations meanwhile
+                if(!pool || !pool->help())
+                    std::this_thread::yield();
+            }
+            std::cout << std::endl;
+            offspring.clear();
+            if(error)
+                std::rethrow_exception(error);
+            return best();
+        }
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "flat_tree.hpp"
+#include "generate.hpp"
+#include "tree.hpp"
+
+/** The signature of a primitive, to derive primitives from
+ *
+ * A primitive is a type with a static arity, result type and argument type
+ * (all its arguments have the same type), a name and a static apply
+ * template computing its value:
+ *
+ *     struct Add : primitive_signature<math_type, math_type::number, 2>
+ *     {
+ *         static const char * name() { return "add"; }
+ *
+ *         template<typename value_t>
+ *         static value_t apply(const value_t *arguments,
+ *                              const value_t *inputs)
+ *         { return arguments[0] + arguments[1]; }
+ *     };
+ *
+ * arguments holds the values of the children, inputs the values of the
+ * variables of the current fitness case. */
+template<typename node_type_t, node_type_t result, unsigned int n,
+         node_type_t argument = result>
+struct primitive_signature
+{
+    static constexpr node_type_t type = result;
+    static constexpr unsigned int arity = n;
+    static constexpr node_type_t argument_type = argument;
+};
+
+template<typename node_type_t, node_type_t result, unsigned int n,
+         node_type_t argument>
+constexpr node_type_t
+    primitive_signature<node_type_t,result,n,argument>::type;
+template<typename node_type_t, node_type_t result, unsigned int n,
+         node_type_t argument>
+constexpr unsigned int
+    primitive_signature<node_type_t,result,n,argument>::arity;
+template<typename node_type_t, node_type_t result, unsigned int n,
+         node_type_t argument>
+constexpr node_type_t
+    primitive_signature<node_type_t,result,n,argument>::argument_type;
+
+/** The largest arity of a list of primitives */
+template<typename... primitives>
+struct max_arity_of
+{
+    static constexpr unsigned int value = 0;
+};
+
+template<typename P, typename... rest>
+struct max_arity_of<P, rest...>
+{
+    static constexpr unsigned int value =
+        P::arity > max_arity_of<rest...>::value
+        ? P::arity : max_arity_of<rest...>::value;
+};
+
+/** The index of a primitive in a list, the size of the list if absent */
+template<typename P, typename... primitives>
+struct primitive_index
+{
+    static constexpr unsigned int value = 0;
+};
+
+template<typename P, typename first, typename... rest>
+struct primitive_index<P, first, rest...>
+{
+    static constexpr unsigned int value = std::is_same<P, first>::value
+        ? 0 : 1 + primitive_index<P, rest...>::value;
+};
+
+/** The value attached to the nodes of trees over a PrimitiveSet: the index
+ * of the primitive in the set */
+template<typename set_t>
+struct primitive_node
+{
+    unsigned int index;
+
+    bool operator==(const primitive_node &other) const
+    { return index == other.index; }
+
+    friend std::ostream & operator<<(std::ostream &os,
+                                     const primitive_node &node)
+    { return os << set_t::name(node.index); }
+};
+
+namespace std
+{
+    template<typename set_t>
+    struct hash<primitive_node<set_t>>
+    {
+        size_t operator()(const primitive_node<set_t> &node) const
+        { return node.index; }
+    };
+}
+
+/** A set of primitives fixed at compile time
+ *
+ * Trees over the set hold primitive_node<PrimitiveSet<...>> values. The
+ * primitive of a node is found by comparing its index with the indices of
+ * the set, which the compiler unrolls, so that the apply functions of the
+ * primitives are inlined into evaluate. This is the fast counterpart of
+ * dispatching on a value with a switch through a std::function fitness.
+ *
+ * \param node_type_t The node type, the same for all the primitives
+ * \param primitives The primitive types (see primitive_signature) */
+template<typename node_type_t, typename... primitives>
+class PrimitiveSet
+{
+    public:
+        typedef primitive_node<PrimitiveSet> node_t;
+        typedef Tree<node_t,node_type_t> tree_t;
+
+        static constexpr unsigned int size = sizeof...(primitives);
+
+    private:
+        template<unsigned int i>
+        using primitive = typename std::tuple_element<i,
+              std::tuple<primitives...>>::type;
+
+        template<unsigned int i, typename value_t>
+        static typename std::enable_if<(i == size), value_t>::type apply_from(
+                unsigned int, const value_t *, const value_t *)
+        { return value_t(); }
+        template<unsigned int i, typename value_t>
+        static typename std::enable_if<(i < size), value_t>::type apply_from(
+                unsigned int index, const value_t *arguments,
+                const value_t *inputs)
+        {
+            if(index == i)
+                return primitive<i>::apply(arguments, inputs);
+            return apply_from<i + 1>(index, arguments, inputs);
+        }
+
+        template<unsigned int i>
+        static typename std::enable_if<(i == size), unsigned int>::type
+            arity_from(unsigned int)
+        { return 0; }
+        template<unsigned int i>
+        static typename std::enable_if<(i < size), unsigned int>::type
+            arity_from(unsigned int index)
+        {
+            return index == i ? primitive<i>::arity
+                : arity_from<i + 1>(index);
+        }
+
+        template<unsigned int i>
+        static typename std::enable_if<(i == size), const char*>::type
+            name_from(unsigned int)
+        { return "?"; }
+        template<unsigned int i>
+        static typename std::enable_if<(i < size), const char*>::type
+            name_from(unsigned int index)
+        {
+            return index == i ? primitive<i>::name()
+                : name_from<i + 1>(index);
+        }
+
+        template<unsigned int i>
+        static typename std::enable_if<(i == size)>::type add_from(
+                Grammar<node_t,node_type_t> &)
+        {}
+        template<unsigned int i>
+        static typename std::enable_if<(i < size)>::type add_from(
+                Grammar<node_t,node_type_t> &grammar)
+        {
+            if(primitive<i>::arity == 0)
+                grammar.add_terminal(node_t{i}, primitive<i>::type);
+            else
+                grammar.add_function(node_t{i}, primitive<i>::type,
+                        std::vector<node_type_t>(primitive<i>::arity,
+                                                 primitive<i>::argument_type));
+            add_from<i + 1>(grammar);
+        }
+
+    public:
+        /// The largest arity of the primitives
+        static constexpr unsigned int max_arity =
+            max_arity_of<primitives...>::value;
+
+        /** Getter for the index of a primitive in the set */
+        template<typename P>
+        static constexpr unsigned int index_of()
+        { return primitive_index<P, primitives...>::value; }
+
+        /** Makes a node of a primitive of the set, in the current arena
+         * \param children The children, as many as the arity of P */
+        template<typename P>
+        static std::shared_ptr<tree_t> make(
+                std::vector<std::shared_ptr<tree_t>> children = {})
+        {
+            static_assert(index_of<P>() < size,
+                          "P is not in the primitive set");
+            return make_tree<tree_t>(node_t{index_of<P>()}, P::type,
+                                     children);
+        }
+
+        static unsigned int arity(unsigned int index)
+        { return arity_from<0>(index); }
+
+        static const char * name(unsigned int index)
+        { return name_from<0>(index); }
+
+        /** Applies the primitive of a node to the values of its children */
+        template<typename value_t>
+        static value_t apply(unsigned int index, const value_t *arguments,
+                             const value_t *inputs)
+        { return apply_from<0>(index, arguments, inputs); }
+
+        /** Evaluates a tree on one fitness case
+         * \param tree The tree
+         * \param inputs The values of the variables
+         * \return The value of the root */
+        template<typename value_t>
+        static value_t evaluate(const tree_t &tree, const value_t *inputs)
+        {
+            value_t arguments[max_arity ? max_arity : 1];
+            unsigned int n = 0;
+            for(auto &child : tree.get_children())
+                arguments[n++] = evaluate(*child, inputs);
+            return apply(tree.get_node().index, arguments, inputs);
+        }
+
+        /** Evaluates a FlatTree on one fitness case, without recursion
+         *
+         * The nodes are scanned backwards, so the values of the children of
+         * a node are on top of the stack, first child on top. */
+        template<typename value_t>
+        static value_t evaluate(const FlatTree<node_t,node_type_t> &tree,
+                                const value_t *inputs)
+        {
+            std::vector<value_t> stack;
+            value_t arguments[max_arity ? max_arity : 1];
+            auto &nodes = tree.get_nodes();
+            for(unsigned int i = nodes.size(); i-- > 0;)
+            {
+                unsigned int index = nodes[i].value.index;
+                unsigned int n = arity(index);
+                for(unsigned int j = 0; j < n; j++)
+                {
+                    arguments[j] = stack.back();
+                    stack.pop_back();
+                }
+                stack.push_back(apply(index, arguments, inputs));
+            }
+            return stack.back();
+        }
+
+        /** Makes a Grammar of the primitives, to generate random trees
+         * (see generate.hpp) */
+        static Grammar<node_t,node_type_t> grammar()
+        {
+            Grammar<node_t,node_type_t> result;
+            add_from<0>(result);
+            return result;
+        }
+};
+
+template<typename node_type_t, typename... primitives>
+constexpr unsigned int PrimitiveSet<node_type_t,primitives...>::size;
+template<typename node_type_t, typename... primitives>
+constexpr unsigned int PrimitiveSet<node_type_t,primitives...>::max_arity;
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+/** One step of the splitmix64 generator
+ *
+ * Used to seed Xoshiro256 and to derive independent seeds: it turns
+ * consecutive or similar inputs into unrelated outputs.
+ * \param state The state of the generator, advanced by the call
+ * \return The next output */
+inline std::uint64_t splitmix64(std::uint64_t &state)
+{
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/** The xoshiro256** random number generator
+ *
+ * Fast, with 32 bytes of state and a period of 2^256 - 1. It satisfies the
+ * requirements of a uniform random bit generator, so it works with the
+ * distributions of <random>.
+ *
+ * Independent streams are derived from a seed and a stream number with
+ * stream(): the seed of a stream is a hash of both, so streams do not
+ * depend on how many numbers the other streams draw. This is what makes
+ * runs reproducible when work is split between threads or operations. */
+class Xoshiro256
+{
+    public:
+        typedef std::uint64_t result_type;
+
+    private:
+        std::uint64_t state[4];
+        /// The seed the generator was created with, to derive streams
+        std::uint64_t seed_value;
+
+        static std::uint64_t rotl(std::uint64_t x, int k)
+        { return (x << k) | (x >> (64 - k)); }
+
+    public:
+        /** Constructor for Xoshiro256
+         * \param seed The seed, runs with the same seed draw the same
+         * numbers */
+        explicit Xoshiro256(std::uint64_t seed = 0) { this->seed(seed); }
+
+        /** Restarts the generator from a seed */
+        void seed(std::uint64_t value)
+        {
+            seed_value = value;
+            std::uint64_t mixer = value;
+            for(std::uint64_t &word : state)
+                word = splitmix64(mixer);
+        }
+
+        /** Getter for the seed the generator was created with */
+        std::uint64_t get_seed() const { return seed_value; }
+
+        /** Derives an independent generator
+         *
+         * The result only depends on the seed of this generator and on the
+         * stream number, not on the numbers drawn so far.
+         * \param id The number of the stream
+         * \return The generator of the stream */
+        Xoshiro256 stream(std::uint64_t id) const
+        {
+            std::uint64_t mixer = seed_value ^ (id * 0xd1b54a32d192ed03ULL);
+            splitmix64(mixer);
+            return Xoshiro256(splitmix64(mixer));
+        }
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max()
+        { return std::numeric_limits<result_type>::max(); }
+
+        result_type operator()()
+        {
+            std::uint64_t result = rotl(state[1] * 5, 7) * 9;
+            std::uint64_t t = state[1] << 17;
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotl(state[3], 45);
+            return result;
+        }
+
+        /** Draws a double uniformly in [0, 1) */
+        double uniform()
+        { return ((*this)() >> 11) * (1.0 / 9007199254740992.0); }
+
+        /** Draws an integer uniformly in [0, n), n must not be 0 */
+        std::uint64_t below(std::uint64_t n)
+        {
+            // Rejects the values of the incomplete last copy of [0, n)
+            std::uint64_t limit = max() - max() % n;
+            std::uint64_t x;
+            do
+                x = (*this)();
+            while(x >= limit);
+            return x % n;
+        }
+};
+
+/** Draws a seed from std::random_device, for runs that need not be
+ * reproducible */
+inline std::uint64_t random_seed()
+{
+    std::random_device rd;
+    return ((std::uint64_t)rd() << 32) ^ rd();
+}
+
+/** Getter for the random number generator of the calling thread, used when
+ * the caller does not give one
+ *
+ * Each thread seeds its own generator with random_seed, so results drawn
+ * from it are not reproducible. */
+inline Xoshiro256 & thread_generator()
+{
+    static thread_local Xoshiro256 gen(random_seed());
+    return gen;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "tree.hpp"
+
+/** Simplifies trees with user-registered rewrite rules
+ *
+ * A rule is given a node whose children are already simplified, and
+ * returns the tree to replace it with, or nullptr if it does not apply.
+ * Nodes are simplified bottom-up: the rules are applied to each node, then
+ * again to its replacement, until none applies. A node is rewritten at most
+ * max_rewrites times, in case rules undo each other.
+ *
+ * Trees are never modified: the nodes above a rewritten node are copied
+ * and the unchanged subtrees are shared (see Tree). The hashes of
+ * simplified subtrees are remembered between calls, so subtrees that are
+ * already simplified, such as the survivors of a generation, are skipped
+ * in O(1). Since only hashes are kept, trees can be freed or their arena
+ * reset between calls.
+ *
+ * A simplifier keeps its memory of simplified subtrees between calls, so
+ * it must not be shared between threads. */
+template<typename T, typename node_type_t>
+class Simplifier
+{
+    public:
+        typedef std::shared_ptr<Tree<T,node_type_t>> tree_ptr_t;
+        typedef std::function<tree_ptr_t(const tree_ptr_t&)> rule_t;
+
+    private:
+        std::vector<rule_t> rules;
+        unsigned int max_rewrites;
+        /// The hashes of the subtrees no rule applies to
+        std::unordered_set<std::uint64_t> simplified;
+        /// The maximal size of simplified
+        std::size_t capacity;
+
+        /** Applies the first rule that matches a node
+         * \return The replacement, nullptr if no rule applies */
+        tree_ptr_t rewrite(const tree_ptr_t &tree) const
+        {
+            for(const rule_t &rule : rules)
+            {
+                tree_ptr_t result = rule(tree);
+                if(result)
+                    return result;
+            }
+            return nullptr;
+        }
+
+        /** Simplifies the children of a node
+         * \return The node with simplified children, tree itself if they
+         * are unchanged */
+        tree_ptr_t simplify_children(const tree_ptr_t &tree)
+        {
+            std::vector<tree_ptr_t> children;
+            bool changed = false;
+            for(const tree_ptr_t &child : tree->get_children())
+            {
+                children.push_back(simplify(child));
+                changed = changed || children.back() != child;
+            }
+            if(!changed)
+                return tree;
+            return make_tree<Tree<T,node_type_t>>(tree->get_node(),
+                                                  tree->get_type(), children);
+        }
+
+    public:
+        /** Constructor for Simplifier
+         * \param max_rewrites The maximal number of rewrites of a node
+         * \param capacity The maximal number of hashes of simplified
+         * subtrees remembered */
+        explicit Simplifier(unsigned int max_rewrites = 16,
+                            std::size_t capacity = 1 << 16)
+            : max_rewrites(max_rewrites), capacity(capacity) {}
+
+        /** Registers a rule, rules are tried in registration order */
+        void add_rule(rule_t rule)
+        {
+            rules.push_back(rule);
+            simplified.clear();
+        }
+
+        /** Simplifies a tree
+         * \param tree The tree, which is not modified
+         * \return The simplified tree, tree itself if no rule applies */
+        tree_ptr_t simplify(const tree_ptr_t &tree)
+        {
+            if(simplified.count(tree->get_hash()))
+                return tree;
+            tree_ptr_t result = simplify_children(tree);
+            for(unsigned int i = 0; i < max_rewrites; i++)
+            {
+                tree_ptr_t rewritten = rewrite(result);
+                if(!rewritten)
+                    break;
+                result = simplify_children(rewritten);
+            }
+            if(simplified.size() >= capacity)
+                simplified.clear();
+            simplified.insert(result->get_hash());
+            return result;
+        }
+
+        tree_ptr_t operator()(const tree_ptr_t &tree)
+        { return simplify(tree); }
+
+        /** Forgets the subtrees known to be simplified */
+        void clear() { simplified.clear(); }
+};
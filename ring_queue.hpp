@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/** A bounded lock-free queue for several producers and several consumers
+ *
+ * The queue is a ring of cells, each with a sequence number telling
+ * whether it is ready to be written or read for a given lap around the
+ * ring. Producers and consumers reserve a cell with a compare-and-swap on
+ * their own counter, so neither ever waits for a lock. push fails instead
+ * of blocking when the queue is full, and pop when it is empty. */
+template<typename T>
+class RingQueue
+{
+    private:
+        struct cell
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        /// Keeps the counters of producers and consumers on separate cache
+        /// lines
+        struct padded_counter
+        {
+            std::atomic<std::size_t> position;
+            char padding[64 - sizeof(std::atomic<std::size_t>)];
+        };
+
+        std::unique_ptr<cell[]> cells;
+        std::size_t mask;
+        padded_counter tail;
+        padded_counter head;
+
+    public:
+        /** Constructor for RingQueue
+         * \param capacity The maximum number of values in the queue,
+         * rounded up to a power of two */
+        explicit RingQueue(std::size_t capacity)
+        {
+            std::size_t size = 2;
+            while(size < capacity)
+                size *= 2;
+            cells.reset(new cell[size]);
+            mask = size - 1;
+            for(std::size_t i = 0; i < size; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            tail.position.store(0, std::memory_order_relaxed);
+            head.position.store(0, std::memory_order_relaxed);
+        }
+        RingQueue(const RingQueue &) = delete;
+        RingQueue & operator=(const RingQueue &) = delete;
+
+        /** Getter for the maximum number of values in the queue */
+        std::size_t capacity() const { return mask + 1; }
+
+        /** Appends a value to the queue
+         * \return false if the queue is full */
+        bool push(const T &value)
+        {
+            std::size_t position = tail.position.load(std::memory_order_relaxed);
+            while(true)
+            {
+                cell &c = cells[position & mask];
+                std::size_t sequence = c.sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t lap = (std::ptrdiff_t)sequence
+                    - (std::ptrdiff_t)position;
+                if(lap == 0)
+                {
+                    if(tail.position.compare_exchange_weak(position,
+                                position + 1, std::memory_order_relaxed))
+                    {
+                        c.value = value;
+                        c.sequence.store(position + 1,
+                                         std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(lap < 0)
+                    return false;
+                else
+                    position = tail.position.load(std::memory_order_relaxed);
+            }
+        }
+
+        /** Removes the oldest value of the queue
+         * \param value Set to the removed value
+         * \return false if the queue is empty */
+        bool pop(T &value)
+        {
+            std::size_t position = head.position.load(std::memory_order_relaxed);
+            while(true)
+            {
+                cell &c = cells[position & mask];
+                std::size_t sequence = c.sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t lap = (std::ptrdiff_t)sequence
+                    - (std::ptrdiff_t)(position + 1);
+                if(lap == 0)
+                {
+                    if(head.position.compare_exchange_weak(position,
+                                position + 1, std::memory_order_relaxed))
+                    {
+                        value = c.value;
+                        c.sequence.store(position + mask + 1,
+                                         std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if(lap < 0)
+                    return false;
+                else
+                    position = head.position.load(std::memory_order_relaxed);
+            }
+        }
+};
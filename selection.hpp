@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "random.hpp"
+
+/** Strategy choosing the survivors of natural selection
+ *
+ * Every strategy runs in time bounded by the size of the population and
+ * the number of survivors, whatever the scores are. */
+class SelectionStrategy
+{
+    public:
+        virtual ~SelectionStrategy() {}
+
+        /** Chooses the survivors of a population
+         * \param scores The scores of the population, higher is better
+         * \param gen The random number generator to use
+         * \param survivors Filled with the indices of the survivors. An
+         * index can appear several times, in which case the individual
+         * survives as several copies. */
+        virtual void select(const std::vector<double> &scores,
+                            Xoshiro256 &gen,
+                            std::vector<unsigned int> &survivors) = 0;
+};
+
+/** Independent survival of each individual
+ *
+ * Each individual survives with probability (score + 1) / (best + 1), so
+ * that the best individual always survives. This takes a single pass and
+ * one random draw per individual. */
+class BernoulliSelection : public SelectionStrategy
+{
+    public:
+        void select(const std::vector<double> &scores, Xoshiro256 &gen,
+                    std::vector<unsigned int> &survivors)
+        {
+            auto best = std::max_element(scores.begin(), scores.end());
+            survivors.clear();
+            for(unsigned int i = 0; i < scores.size(); i++)
+            {
+                double probability = (scores[i] + 1) / (*best + 1);
+                if(gen.uniform() < probability)
+                    survivors.push_back(i);
+            }
+            // With negative scores, everyone can die
+            if(survivors.empty() && !scores.empty())
+                survivors.push_back(std::distance(scores.begin(), best));
+        }
+};
+
+/** Tournament selection
+ *
+ * Each survivor is the best of k individuals drawn uniformly, which makes
+ * the selection pressure independent of the scale of the scores. */
+class TournamentSelection : public SelectionStrategy
+{
+    private:
+        double survival_rate;
+        unsigned int k;
+    public:
+        /** Constructor for TournamentSelection
+         * \param survival_rate The number of survivors, as a fraction of
+         * the population
+         * \param k The number of individuals in each tournament */
+        TournamentSelection(double survival_rate = 0.5, unsigned int k = 3)
+            : survival_rate(survival_rate), k(k ? k : 1) {}
+
+        void select(const std::vector<double> &scores, Xoshiro256 &gen,
+                    std::vector<unsigned int> &survivors)
+        {
+            survivors.clear();
+            if(scores.empty())
+                return;
+            unsigned int count = std::max(1u,
+                    (unsigned int)(survival_rate * scores.size()));
+            for(unsigned int i = 0; i < count; i++)
+            {
+                unsigned int winner = gen.below(scores.size());
+                for(unsigned int j = 1; j < k; j++)
+                {
+                    unsigned int challenger = gen.below(scores.size());
+                    if(scores[challenger] > scores[winner])
+                        winner = challenger;
+                }
+                survivors.push_back(winner);
+            }
+        }
+};
+
+/** Stochastic universal sampling
+ *
+ * Fitness proportional selection where the survivors are read off evenly
+ * spaced pointers over the cumulated scores, from a single random offset.
+ * Negative scores are shifted so that the worst individual has a score of
+ * zero. */
+class StochasticUniversalSampling : public SelectionStrategy
+{
+    private:
+        double survival_rate;
+    public:
+        /** Constructor for StochasticUniversalSampling
+         * \param survival_rate The number of survivors, as a fraction of
+         * the population */
+        StochasticUniversalSampling(double survival_rate = 0.5)
+            : survival_rate(survival_rate) {}
+
+        void select(const std::vector<double> &scores, Xoshiro256 &gen,
+                    std::vector<unsigned int> &survivors)
+        {
+            survivors.clear();
+            if(scores.empty())
+                return;
+            unsigned int count = std::max(1u,
+                    (unsigned int)(survival_rate * scores.size()));
+            double lowest = *std::min_element(scores.begin(), scores.end());
+            double shift = lowest < 0 ? -lowest : 0;
+            double total = std::accumulate(scores.begin(), scores.end(), 0.0)
+                + shift * scores.size();
+            if(total <= 0)
+            {
+                // All scores are equal to zero: sample uniformly
+                for(unsigned int i = 0; i < count; i++)
+                    survivors.push_back(
+                            (unsigned long)i * scores.size() / count);
+                return;
+            }
+            double spacing = total / count;
+            double pointer = gen.uniform() * spacing;
+            double cumulated = 0;
+            unsigned int i = 0;
+            for(unsigned int j = 0; j < count; j++)
+            {
+                while(i + 1 < scores.size()
+                      && cumulated + scores[i] + shift <= pointer)
+                {
+                    cumulated += scores[i] + shift;
+                    i++;
+                }
+                survivors.push_back(i);
+                pointer += spacing;
+            }
+        }
+};
+
+/** Truncation selection: the best individuals survive */
+class TruncationSelection : public SelectionStrategy
+{
+    private:
+        double survival_rate;
+    public:
+        /** Constructor for TruncationSelection
+         * \param survival_rate The number of survivors, as a fraction of
+         * the population */
+        TruncationSelection(double survival_rate = 0.5)
+            : survival_rate(survival_rate) {}
+
+        void select(const std::vector<double> &scores, Xoshiro256 &gen,
+                    std::vector<unsigned int> &survivors)
+        {
+            survivors.resize(scores.size());
+            if(scores.empty())
+                return;
+            unsigned int count = std::max(1u,
+                    (unsigned int)(survival_rate * scores.size()));
+            count = std::min(count, (unsigned int)scores.size());
+            std::iota(survivors.begin(), survivors.end(), 0);
+            std::nth_element(survivors.begin(), survivors.begin() + count - 1,
+                    survivors.end(),
+                    [&scores](unsigned int a, unsigned int b) {
+                        return scores[a] > scores[b];
+                    });
+            survivors.resize(count);
+        }
+};
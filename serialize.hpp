@@ -0,0 +1,333 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_tree.hpp"
+#include "tree.hpp"
+
+/** How values of type T are stored in the binary form of trees
+ *
+ * A specialization provides the number of bytes of a stored value and
+ * functions to store and restore one:
+ *
+ *     static const std::size_t size;
+ *     static void write(const T &value, char *out);
+ *     static T read(const char *in);
+ *
+ * The default one copies the bytes of trivially copyable types, such as
+ * numbers and enumerations. Other types, and types holding pointers, need
+ * their own specialization. */
+template<typename T>
+struct serial_traits
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "serial_traits must be specialized for this type");
+
+    static const std::size_t size = sizeof(T);
+
+    static void write(const T &value, char *out)
+    { std::memcpy(out, &value, sizeof(T)); }
+
+    static T read(const char *in)
+    {
+        T value;
+        std::memcpy(&value, in, sizeof(T));
+        return value;
+    }
+};
+
+/** The binary form of the nodes of trees with values of type T
+ *
+ * A tree is stored as its number of nodes followed by its nodes in prefix
+ * order. Each node is a fixed size record: the number of nodes of its
+ * subtree, its type and its value. Subtrees are thus contiguous ranges of
+ * records that are read in place, without any parsing. Numbers are stored
+ * in the byte order of the machine. */
+template<typename T, typename node_type_t>
+struct serial_node
+{
+    /// The size in bytes of a node record
+    static const std::size_t bytes = sizeof(std::uint32_t)
+        + serial_traits<node_type_t>::size + serial_traits<T>::size;
+
+    static void write(char *out, const T &value, node_type_t type,
+                      std::uint32_t size)
+    {
+        std::memcpy(out, &size, sizeof(size));
+        out += sizeof(size);
+        serial_traits<node_type_t>::write(type, out);
+        serial_traits<T>::write(value, out + serial_traits<node_type_t>::size);
+    }
+
+    static std::uint32_t size(const char *in)
+    {
+        std::uint32_t size;
+        std::memcpy(&size, in, sizeof(size));
+        return size;
+    }
+
+    static node_type_t type(const char *in)
+    { return serial_traits<node_type_t>::read(in + sizeof(std::uint32_t)); }
+
+    static T value(const char *in)
+    {
+        return serial_traits<T>::read(in + sizeof(std::uint32_t)
+                                      + serial_traits<node_type_t>::size);
+    }
+};
+
+/** Appends a value of trivially copyable type to a buffer */
+template<typename U>
+void serial_append(std::vector<char> &buffer, const U &value)
+{
+    std::size_t start = buffer.size();
+    buffer.resize(start + sizeof(U));
+    std::memcpy(&buffer[start], &value, sizeof(U));
+}
+
+/** Reads a value of trivially copyable type from a buffer
+ * \param in The read position, advanced past the value
+ * \param end The end of the buffer
+ * \return The value */
+template<typename U>
+U serial_extract(const char *&in, const char *end)
+{
+    if((std::size_t)(end - in) < sizeof(U))
+        throw std::runtime_error("truncated binary data");
+    U value;
+    std::memcpy(&value, in, sizeof(U));
+    in += sizeof(U);
+    return value;
+}
+
+template<typename T, typename node_type_t>
+unsigned int node_count(const Tree<T,node_type_t> &tree)
+{ return tree.get_size(); }
+
+template<typename T, typename node_type_t>
+unsigned int node_count(const FlatTree<T,node_type_t> &tree)
+{ return tree.size(); }
+
+template<typename T, typename node_type_t>
+void write_nodes(const Tree<T,node_type_t> &tree, char *&out)
+{
+    serial_node<T,node_type_t>::write(out, tree.get_node(), tree.get_type(),
+                                      tree.get_size());
+    out += serial_node<T,node_type_t>::bytes;
+    for(auto &child : tree.get_children())
+        write_nodes(*child, out);
+}
+
+template<typename T, typename node_type_t>
+void write_nodes(const FlatTree<T,node_type_t> &tree, char *&out)
+{
+    for(auto &node : tree.get_nodes())
+    {
+        serial_node<T,node_type_t>::write(out, node.value, node.type,
+                                          node.size);
+        out += serial_node<T,node_type_t>::bytes;
+    }
+}
+
+/** Appends the binary form of a tree to a buffer
+ *
+ * Subtrees shared by several nodes are written once per occurrence.
+ * \param buffer The buffer to append to
+ * \param tree The tree, a Tree or a FlatTree */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t>
+void write_tree(std::vector<char> &buffer,
+                const tree_t<T,node_type_t> &tree)
+{
+    std::uint32_t count = node_count(tree);
+    std::size_t start = buffer.size();
+    buffer.resize(start + sizeof(count)
+                  + count * serial_node<T,node_type_t>::bytes);
+    char *out = &buffer[start];
+    std::memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+    write_nodes(tree, out);
+}
+
+/** Checks that the subtree sizes of node records nest properly
+ * \param nodes The first record
+ * \param count The number of records
+ * \return Whether the records form a single tree */
+template<typename T, typename node_type_t>
+bool valid_nodes(const char *nodes, std::uint32_t count)
+{
+    // The ends of the subtrees enclosing the current node
+    std::vector<std::uint32_t> ends;
+    for(std::uint32_t i = 0; i < count; i++)
+    {
+        std::uint32_t size = serial_node<T,node_type_t>::size(
+                nodes + i * serial_node<T,node_type_t>::bytes);
+        while(!ends.empty() && ends.back() <= i)
+            ends.pop_back();
+        std::uint32_t limit = ends.empty() ? count : ends.back();
+        if(size == 0 || size > limit - i || (i == 0 && size != count)
+           || (i > 0 && ends.empty()))
+            return false;
+        ends.push_back(i + size);
+    }
+    return true;
+}
+
+template<typename T, typename node_type_t>
+std::shared_ptr<Tree<T,node_type_t>> build_tree(const char *nodes,
+        std::uint32_t &index, Tree<T,node_type_t> *)
+{
+    const char *record = nodes + index * serial_node<T,node_type_t>::bytes;
+    std::uint32_t end = index + serial_node<T,node_type_t>::size(record);
+    index++;
+    std::vector<std::shared_ptr<Tree<T,node_type_t>>> children;
+    while(index < end)
+        children.push_back(build_tree(nodes, index,
+                                      (Tree<T,node_type_t>*)nullptr));
+    return make_tree<Tree<T,node_type_t>>(
+            serial_node<T,node_type_t>::value(record),
+            serial_node<T,node_type_t>::type(record), children);
+}
+
+template<typename T, typename node_type_t>
+std::shared_ptr<FlatTree<T,node_type_t>> build_tree(const char *nodes,
+        std::uint32_t &index, FlatTree<T,node_type_t> *)
+{
+    typedef typename FlatTree<T,node_type_t>::node_t node_t;
+    std::uint32_t count = serial_node<T,node_type_t>::size(nodes);
+    typename FlatTree<T,node_type_t>::nodes_t flat;
+    flat.reserve(count);
+    for(; index < count; index++)
+    {
+        const char *record = nodes + index * serial_node<T,node_type_t>::bytes;
+        flat.push_back(node_t(serial_node<T,node_type_t>::value(record),
+                              serial_node<T,node_type_t>::type(record),
+                              serial_node<T,node_type_t>::size(record)));
+    }
+    return make_tree<FlatTree<T,node_type_t>>(std::move(flat));
+}
+
+/** Reads a tree written by write_tree, in the current arena
+ * \param in The read position, advanced past the tree
+ * \param end The end of the buffer
+ * \return The tree, a Tree or a FlatTree according to tree_t */
+template<typename T, typename node_type_t,
+         template<typename,typename> class tree_t>
+std::shared_ptr<tree_t<T,node_type_t>> read_tree(const char *&in,
+                                                  const char *end)
+{
+    std::uint32_t count = serial_extract<std::uint32_t>(in, end);
+    if(count == 0 || (std::size_t)(end - in) / serial_node<T,node_type_t>::bytes
+                     < count
+       || !valid_nodes<T,node_type_t>(in, count))
+        throw std::runtime_error("malformed tree in binary data");
+    std::uint32_t index = 0;
+    auto tree = build_tree(in, index, (tree_t<T,node_type_t>*)nullptr);
+    in += count * serial_node<T,node_type_t>::bytes;
+    return tree;
+}
+
+/** A whole file mapped in memory, read-only */
+class MappedFile
+{
+    private:
+        char *data = nullptr;
+        std::size_t length = 0;
+
+    public:
+        /** Maps a file
+         * \param path The path of the file
+         * \param advice How the file will be read, given to madvise: the
+         * default MADV_SEQUENTIAL suits a file read once from start to
+         * end, and lets the kernel drop the pages already read
+         * \throw std::runtime_error If the file cannot be mapped */
+        explicit MappedFile(const std::string &path,
+                            int advice = MADV_SEQUENTIAL)
+        {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+                throw std::runtime_error("cannot open " + path + ": "
+                                         + std::strerror(errno));
+            struct stat status;
+            if(::fstat(fd, &status) == 0 && status.st_size > 0)
+            {
+                length = status.st_size;
+                void *mapped = ::mmap(nullptr, length, PROT_READ,
+                                      MAP_PRIVATE, fd, 0);
+                if(mapped == MAP_FAILED)
+                {
+                    int error = errno;
+                    ::close(fd);
+                    throw std::runtime_error("cannot map " + path + ": "
+                                             + std::strerror(error));
+                }
+                data = static_cast<char*>(mapped);
+                ::madvise(data, length, advice);
+            }
+            ::close(fd);
+        }
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator=(const MappedFile &) = delete;
+        ~MappedFile()
+        {
+            if(data)
+                ::munmap(data, length);
+        }
+
+        const char * begin() const { return data; }
+        const char * end() const { return data + length; }
+        std::size_t size() const { return length; }
+};
+
+/** Replaces the content of a file, so that a crash leaves either the old
+ * or the new content
+ *
+ * The data is written to path.tmp, flushed to the disk, then renamed to
+ * path.
+ * \throw std::runtime_error If the file cannot be written */
+inline void write_file_atomically(const std::string &path,
+                                  const std::vector<char> &data)
+{
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw std::runtime_error("cannot create " + temporary + ": "
+                                 + std::strerror(errno));
+    std::size_t written = 0;
+    while(written < data.size())
+    {
+        ssize_t result = ::write(fd, data.data() + written,
+                                 data.size() - written);
+        if(result < 0 && errno == EINTR)
+            continue;
+        if(result < 0)
+        {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("cannot write " + temporary + ": "
+                                     + std::strerror(error));
+        }
+        written += result;
+    }
+    bool synced = ::fsync(fd) == 0;
+    if(::close(fd) != 0 || !synced)
+        throw std::runtime_error("cannot write " + temporary + ": "
+                                 + std::strerror(errno));
+    if(std::rename(temporary.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("cannot rename " + temporary + ": "
+                                 + std::strerror(errno));
+}
@@ -0,0 +1,537 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "batch.hpp"
+#include "bytecode.hpp"
+#include "generate.hpp"
+#include "incremental.hpp"
+#include "optimizer.hpp"
+#include "primitives.hpp"
+#include "random.hpp"
+#include "rewrite.hpp"
+#include "serialize.hpp"
+#include "tree.hpp"
+
+enum class math_type
+{
+    number,
+    boolean
+};
+
+template<>
+struct node_type_count<math_type>
+{
+    static const unsigned int value = 2;
+};
+
+enum class sym_t
+{
+    x,
+    plus,
+    one,
+    equals,
+    /// A constant other than one, only produced by simplification
+    number,
+    /// The product of the children, only produced by simplification
+    times
+};
+
+class Symbol
+{
+    private:
+        sym_t type;
+        /// The value of number symbols
+        double value;
+    public:
+        Symbol(sym_t type, double value = 0) : type(type), value(value) {}
+        Symbol(const Symbol &copy) : type(copy.type), value(copy.value) {}
+
+        const sym_t & get_type() const { return type; }
+        double get_value() const { return value; }
+
+        bool operator==(const Symbol &other) const
+        { return type == other.type && value == other.value; }
+
+        friend std::ostream & operator<<(std::ostream &os, const Symbol &sym)
+        {
+            switch(sym.type)
+            {
+                case sym_t::x:
+                    os << "x";
+                    break;
+                case sym_t::plus:
+                    os << "plus";
+                    break;
+                case sym_t::one:
+                    os << "one";
+                    break;
+                case sym_t::equals:
+                    os << "==";
+                    break;
+                case sym_t::number:
+                    os << sym.value;
+                    break;
+                case sym_t::times:
+                    os << "times";
+                    break;
+                default:
+                    break;
+            }
+            return os;
+        }
+};
+
+namespace std
+{
+    template<>
+    struct hash<Symbol>
+    {
+        size_t operator()(const Symbol &symbol) const
+        {
+            return static_cast<size_t>(symbol.get_type()) * 31
+                + hash<double>()(symbol.get_value());
+        }
+    };
+}
+
+/** Stores a Symbol as its sym_t and its value in checkpoints */
+template<>
+struct serial_traits<Symbol>
+{
+    static const std::size_t size = serial_traits<sym_t>::size
+        + serial_traits<double>::size;
+
+    static void write(const Symbol &value, char *out)
+    {
+        serial_traits<sym_t>::write(value.get_type(), out);
+        serial_traits<double>::write(value.get_value(),
+                                     out + serial_traits<sym_t>::size);
+    }
+
+    static Symbol read(const char *in)
+    {
+        return Symbol(serial_traits<sym_t>::read(in),
+                      serial_traits<double>::read(
+                              in + serial_traits<sym_t>::size));
+    }
+};
+
+inline tree_ptr<Symbol,math_type> random_numerical_expression(
+        Xoshiro256 &gen)
+{
+    double random = gen.uniform();
+    if(random < 0.3)
+    {
+        return make_tree<Tree<Symbol,math_type>>(
+                Symbol(sym_t::x),
+                math_type::number);
+    }
+    else if(random < 0.6)
+    {
+        auto child1 = random_numerical_expression(gen);
+        auto child2 = random_numerical_expression(gen);
+        auto tree = make_tree<Tree<Symbol,math_type>>(
+                Symbol(sym_t::plus),
+                math_type::number);
+        tree->add(child1);
+        tree->add(child2);
+        return tree;
+    }
+    else
+    {
+        return make_tree<Tree<Symbol,math_type>>(
+                Symbol(sym_t::one),
+                math_type::number);
+    }
+}
+
+/** Getter for the grammar of random equations: x, one, plus and equals */
+inline const Grammar<Symbol,math_type> & symbolic_grammar()
+{
+    static const Grammar<Symbol,math_type> grammar = []() {
+        Grammar<Symbol,math_type> g;
+        g.add_function(Symbol(sym_t::equals), math_type::boolean,
+                       {math_type::number, math_type::number});
+        g.add_function(Symbol(sym_t::plus), math_type::number,
+                       {math_type::number, math_type::number});
+        g.add_terminal(Symbol(sym_t::x), math_type::number);
+        g.add_terminal(Symbol(sym_t::one), math_type::number);
+        return g;
+    }();
+    return grammar;
+}
+
+/// The size limits of random and evolved equations
+const unsigned int symbolic_max_depth = 8;
+const unsigned int symbolic_max_nodes = 64;
+
+/** Generates a random equation with the ramped half-and-half method, of 2
+ * to 5 levels */
+inline tree_ptr<Symbol,math_type> random_tree(Xoshiro256 &gen)
+{
+    return symbolic_grammar().ramped_half_and_half(gen, math_type::boolean,
+                                                   2, 5, symbolic_max_nodes);
+}
+
+inline double evaluate(tree_ptr<Symbol,math_type> tree, double x_value)
+{
+    switch(tree->get_node().get_type())
+    {
+        case sym_t::x:
+            return x_value;
+        case sym_t::plus:
+            {
+                double sum = 0.0;
+                for(auto &child : tree->get_children())
+                    sum += evaluate(child, x_value);
+                return sum;
+            }
+        case sym_t::times:
+            {
+                double product = 1.0;
+                for(auto &child : tree->get_children())
+                    product *= evaluate(child, x_value);
+                return product;
+            }
+        case sym_t::one:
+            return 1.0;
+        case sym_t::number:
+            return tree->get_node().get_value();
+        default:
+            return 0.0;
+    }
+}
+
+inline instruction<double> encode(const Symbol &symbol)
+{
+    switch(symbol.get_type())
+    {
+        case sym_t::x:
+            return instruction<double>::variable(0);
+        case sym_t::plus:
+            return instruction<double>(opcode::add);
+        case sym_t::times:
+            return instruction<double>(opcode::mul);
+        case sym_t::one:
+            return instruction<double>::constant(1.0);
+        case sym_t::number:
+            return instruction<double>::constant(symbol.get_value());
+        default:
+            return instruction<double>::constant(0.0);
+    }
+}
+
+/** Getter for the fitness cases: x = 1, 2 and 3 */
+inline const Dataset<double> & fitness_cases()
+{
+    static const Dataset<double> cases({{1.0, 2.0, 3.0}});
+    return cases;
+}
+
+inline double fitness(tree_ptr<Symbol,math_type> tree)
+{
+    // Subtrees left unchanged by cross over are not evaluated again
+    static thread_local IncrementalEvaluator<double> evaluator(
+            fitness_cases());
+    static thread_local std::vector<double> left;
+    const double *output = evaluator.run(*tree->get_children()[0], &encode);
+    left.assign(output, output + fitness_cases().rows());
+    const double *right = evaluator.run(*tree->get_children()[1], &encode);
+    double error1 = std::abs(left[0] - right[0]);
+    double error2 = std::abs(left[1] - right[1]);
+    double error3 = std::abs(left[2] - 10.0);
+    double error = error1 + error2 + error3;
+    return 1.0 / (error + 1.0);
+}
+
+inline unsigned int count_type(tree_ptr<Symbol,math_type> tree, sym_t type)
+{
+    sym_t t = tree->get_node().get_type();
+    if(t == type)
+    {
+        return 1;
+    }
+    else if(t == sym_t::plus || t == sym_t::times)
+    {
+        unsigned int count = 0;
+        for(auto &child : tree->get_children())
+            count += count_type(child, type);
+        return count;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+inline bool is_constant(const tree_ptr<Symbol,math_type> &tree)
+{
+    sym_t t = tree->get_node().get_type();
+    return t == sym_t::one || t == sym_t::number;
+}
+
+inline double constant_value(const tree_ptr<Symbol,math_type> &tree)
+{
+    if(tree->get_node().get_type() == sym_t::one)
+        return 1.0;
+    return tree->get_node().get_value();
+}
+
+/** Makes a constant leaf, one if the value is 1 */
+inline tree_ptr<Symbol,math_type> make_constant(double value)
+{
+    if(value == 1.0)
+        return make_tree<Tree<Symbol,math_type>>(Symbol(sym_t::one),
+                                                 math_type::number);
+    return make_tree<Tree<Symbol,math_type>>(Symbol(sym_t::number, value),
+                                             math_type::number);
+}
+
+inline tree_ptr<Symbol,math_type> make_operation(sym_t type,
+        const std::vector<tree_ptr<Symbol,math_type>> &children)
+{
+    return make_tree<Tree<Symbol,math_type>>(Symbol(type), math_type::number,
+                                             children);
+}
+
+inline bool is_operation(const tree_ptr<Symbol,math_type> &tree)
+{
+    sym_t t = tree->get_node().get_type();
+    return t == sym_t::plus || t == sym_t::times;
+}
+
+/** Rule replacing plus(a, plus(b, c)) by plus(a, b, c), and the same for
+ * times */
+inline tree_ptr<Symbol,math_type> flatten_operations(
+        const tree_ptr<Symbol,math_type> &tree)
+{
+    if(!is_operation(tree))
+        return nullptr;
+    sym_t t = tree->get_node().get_type();
+    std::vector<tree_ptr<Symbol,math_type>> children;
+    bool nested = false;
+    for(auto &child : tree->get_children())
+    {
+        if(child->get_node().get_type() == t)
+        {
+            nested = true;
+            for(auto &grandchild : child->get_children())
+                children.push_back(grandchild);
+        }
+        else
+        {
+            children.push_back(child);
+        }
+    }
+    return nested ? make_operation(t, children) : nullptr;
+}
+
+/** Rule replacing the constant children of plus and times by their sum or
+ * product */
+inline tree_ptr<Symbol,math_type> fold_constants(
+        const tree_ptr<Symbol,math_type> &tree)
+{
+    if(!is_operation(tree))
+        return nullptr;
+    bool sum = tree->get_node().get_type() == sym_t::plus;
+    double value = sum ? 0.0 : 1.0;
+    unsigned int constants = 0;
+    std::vector<tree_ptr<Symbol,math_type>> children(1);
+    for(auto &child : tree->get_children())
+    {
+        if(is_constant(child))
+        {
+            value = sum ? value + constant_value(child)
+                        : value * constant_value(child);
+            constants++;
+        }
+        else
+        {
+            children.push_back(child);
+        }
+    }
+    if(constants < 2)
+        return nullptr;
+    if(children.size() == 1)
+        return make_constant(value);
+    children[0] = make_constant(value);
+    return make_operation(tree->get_node().get_type(), children);
+}
+
+/** Rule removing the operations with a single child, the additions of 0
+ * and the multiplications by 1, and replacing multiplications by 0 by 0 */
+inline tree_ptr<Symbol,math_type> remove_identities(
+        const tree_ptr<Symbol,math_type> &tree)
+{
+    if(!is_operation(tree))
+        return nullptr;
+    auto &children = tree->get_children();
+    if(children.size() == 1)
+        return children[0];
+    bool sum = tree->get_node().get_type() == sym_t::plus;
+    double identity = sum ? 0.0 : 1.0;
+    std::vector<tree_ptr<Symbol,math_type>> kept;
+    for(auto &child : children)
+    {
+        if(!is_constant(child))
+            kept.push_back(child);
+        else if(!sum && constant_value(child) == 0.0)
+            return make_constant(0.0);
+        else if(constant_value(child) != identity)
+            kept.push_back(child);
+    }
+    if(kept.size() == children.size())
+        return nullptr;
+    if(kept.empty())
+        return make_constant(identity);
+    return make_operation(tree->get_node().get_type(), kept);
+}
+
+/** Rule replacing the repeated terms of a sum by multiplications:
+ * plus(x, x, times(3, x)) becomes times(5, x)
+ *
+ * Terms are compared by their structural hash. */
+inline tree_ptr<Symbol,math_type> collect_terms(
+        const tree_ptr<Symbol,math_type> &tree)
+{
+    if(tree->get_node().get_type() != sym_t::plus)
+        return nullptr;
+    std::vector<tree_ptr<Symbol,math_type>> constants;
+    std::vector<tree_ptr<Symbol,math_type>> bases;
+    std::vector<double> coefficients;
+    bool repeated = false;
+    for(auto &child : tree->get_children())
+    {
+        if(is_constant(child))
+        {
+            constants.push_back(child);
+            continue;
+        }
+        // A term is a base multiplied by a constant coefficient
+        tree_ptr<Symbol,math_type> base = child;
+        double coefficient = 1.0;
+        auto &factors = child->get_children();
+        if(child->get_node().get_type() == sym_t::times && factors.size() == 2
+           && is_constant(factors[0]) != is_constant(factors[1]))
+        {
+            unsigned int constant = is_constant(factors[0]) ? 0 : 1;
+            base = factors[1 - constant];
+            coefficient = constant_value(factors[constant]);
+        }
+        unsigned int i = 0;
+        while(i < bases.size() && bases[i]->get_hash() != base->get_hash())
+            i++;
+        if(i < bases.size())
+        {
+            coefficients[i] += coefficient;
+            repeated = true;
+        }
+        else
+        {
+            bases.push_back(base);
+            coefficients.push_back(coefficient);
+        }
+    }
+    if(!repeated)
+        return nullptr;
+    std::vector<tree_ptr<Symbol,math_type>> children = constants;
+    for(unsigned int i = 0; i < bases.size(); i++)
+    {
+        if(coefficients[i] == 1.0)
+            children.push_back(bases[i]);
+        else if(coefficients[i] != 0.0)
+            children.push_back(make_operation(sym_t::times,
+                    {make_constant(coefficients[i]), bases[i]}));
+    }
+    if(children.empty())
+        return make_constant(0.0);
+    return make_operation(sym_t::plus, children);
+}
+
+/** Makes a Simplifier applying the rules above to symbolic expressions */
+inline Simplifier<Symbol,math_type> symbolic_simplifier()
+{
+    Simplifier<Symbol,math_type> simplifier;
+    simplifier.add_rule(&flatten_operations);
+    simplifier.add_rule(&remove_identities);
+    simplifier.add_rule(&fold_constants);
+    simplifier.add_rule(&collect_terms);
+    return simplifier;
+}
+
+/* The same problem over a PrimitiveSet: the primitives are types, and the
+ * fitness is a functor type given to Optimizer, so that evaluation is
+ * inlined instead of going through std::function and a switch. */
+
+struct VariableX : primitive_signature<math_type, math_type::number, 0>
+{
+    static const char * name() { return "x"; }
+
+    template<typename value_t>
+    static value_t apply(const value_t *, const value_t *inputs)
+    { return inputs[0]; }
+};
+
+struct ConstantOne : primitive_signature<math_type, math_type::number, 0>
+{
+    static const char * name() { return "one"; }
+
+    template<typename value_t>
+    static value_t apply(const value_t *, const value_t *)
+    { return value_t(1); }
+};
+
+struct Add : primitive_signature<math_type, math_type::number, 2>
+{
+    static const char * name() { return "plus"; }
+
+    template<typename value_t>
+    static value_t apply(const value_t *arguments, const value_t *)
+    { return arguments[0] + arguments[1]; }
+};
+
+struct Equal : primitive_signature<math_type, math_type::boolean, 2,
+                                   math_type::number>
+{
+    static const char * name() { return "=="; }
+
+    template<typename value_t>
+    static value_t apply(const value_t *arguments, const value_t *)
+    { return arguments[0] == arguments[1] ? value_t(1) : value_t(0); }
+};
+
+typedef PrimitiveSet<math_type, VariableX, ConstantOne, Add, Equal>
+    symbolic_set;
+typedef tree_ptr<symbolic_set::node_t,math_type> symbolic_tree;
+
+/** The fitness of the symbolic example over symbolic_set */
+struct symbolic_fitness
+{
+    double operator()(const symbolic_tree &tree) const
+    {
+        const symbolic_set::tree_t &left = *tree->get_children()[0];
+        const symbolic_set::tree_t &right = *tree->get_children()[1];
+        double error = 0.0;
+        for(double x : {1.0, 2.0})
+            error += std::abs(symbolic_set::evaluate(left, &x)
+                              - symbolic_set::evaluate(right, &x));
+        double x = 3.0;
+        error += std::abs(symbolic_set::evaluate(left, &x) - 10.0);
+        return 1.0 / (error + 1.0);
+    }
+};
+
+/** Generates a random equation over symbolic_set with the ramped
+ * half-and-half method, of 2 to 5 levels */
+inline symbolic_tree random_symbolic_tree(Xoshiro256 &gen)
+{
+    static const Grammar<symbolic_set::node_t,math_type> grammar =
+        symbolic_set::grammar();
+    return grammar.ramped_half_and_half(gen, math_type::boolean, 2, 5,
+                                        symbolic_max_nodes);
+}
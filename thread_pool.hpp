@@ -0,0 +1,273 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** A persistent pool of worker threads with work stealing
+ *
+ * Each worker owns a queue of tasks. Work submitted to the pool is spread
+ * over the queues, a worker pops tasks from the back of its own queue and,
+ * once it is empty, steals from the front of the queues of the others. This
+ * balances the load when tasks have very different costs. Idle workers
+ * sleep until new tasks are submitted. */
+class ThreadPool
+{
+    private:
+        /** A range of indices to run a function on */
+        struct task
+        {
+            void (*run)(void *context, std::size_t begin, std::size_t end);
+            void *context;
+            std::size_t begin;
+            std::size_t end;
+        };
+
+        struct worker_queue
+        {
+            std::mutex mutex;
+            std::deque<task> tasks;
+        };
+
+        /** The state shared by the tasks of one parallel_for */
+        template<typename F>
+        struct job
+        {
+            F *body;
+            std::atomic<std::size_t> remaining;
+            std::mutex error_mutex;
+            std::exception_ptr error;
+
+            static void run(void *context, std::size_t begin, std::size_t end)
+            {
+                job *self = static_cast<job*>(context);
+                try
+                {
+                    for(std::size_t i = begin; i < end; i++)
+                        (*self->body)(i);
+                }
+                catch(...)
+                {
+                    std::lock_guard<std::mutex> lock(self->error_mutex);
+                    if(!self->error)
+                        self->error = std::current_exception();
+                }
+                self->remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        };
+
+        /** A function run once, on its own */
+        template<typename F>
+        struct detached
+        {
+            F body;
+
+            explicit detached(F body) : body(body) {}
+
+            static void run(void *context, std::size_t, std::size_t)
+            {
+                detached *self = static_cast<detached*>(context);
+                self->body();
+                delete self;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        /// One queue per worker, plus one for the threads calling the pool
+        std::vector<std::unique_ptr<worker_queue>> queues;
+        /// The number of tasks waiting in the queues
+        std::atomic<std::size_t> queued;
+        /// The queue the next submitted task goes to
+        std::atomic<std::size_t> next_queue;
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+
+        void push(std::size_t queue, const task &t)
+        {
+            {
+                std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+                queues[queue]->tasks.push_back(t);
+            }
+            queued.fetch_add(1, std::memory_order_release);
+        }
+
+        /** Pops a task from a queue, or steals one from another queue
+         * \param queue The queue of the calling thread
+         * \param t Set to the task found
+         * \return Whether a task was found */
+        bool take(std::size_t queue, task &t)
+        {
+            if(queued.load(std::memory_order_acquire) == 0)
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+                if(!queues[queue]->tasks.empty())
+                {
+                    t = queues[queue]->tasks.back();
+                    queues[queue]->tasks.pop_back();
+                    queued.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            for(std::size_t i = 1; i < queues.size(); i++)
+            {
+                worker_queue &victim = *queues[(queue + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if(!victim.tasks.empty())
+                {
+                    t = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    queued.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(std::size_t queue)
+        {
+            task t;
+            while(true)
+            {
+                if(take(queue, t))
+                {
+                    t.run(t.context, t.begin, t.end);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [this]() {
+                    return stopping || queued.load() > 0;
+                });
+                if(stopping)
+                    return;
+            }
+        }
+
+    public:
+        /** Constructor for ThreadPool
+         * \param workers The number of worker threads. The thread calling
+         * parallel_for also runs tasks while it waits, so a pool with n - 1
+         * workers keeps n cores busy. */
+        explicit ThreadPool(unsigned int workers)
+            : queued(0), next_queue(0)
+        {
+            for(unsigned int i = 0; i <= workers; i++)
+                queues.emplace_back(new worker_queue());
+            for(unsigned int i = 0; i < workers; i++)
+                threads.emplace_back(&ThreadPool::work, this, i + 1);
+        }
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator=(const ThreadPool &) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(std::thread &thread : threads)
+                thread.join();
+        }
+
+        /** Getter for the number of threads running tasks, the calling
+         * thread included */
+        unsigned int size() const { return threads.size() + 1; }
+
+        /** Runs body() on one of the workers, without waiting for it
+         *
+         * body must not throw, and must be done before the pool is
+         * destroyed: tasks still queued then are never run. With no
+         * workers, body is run immediately by the calling thread.
+         * \param body The function to call */
+        template<typename F>
+        void submit(F body)
+        {
+            if(threads.empty())
+            {
+                body();
+                return;
+            }
+            detached<F> *d = new detached<F>(body);
+            // Queue 0 is only emptied by helping threads and by stealing
+            std::size_t queue = next_queue.fetch_add(1) % threads.size() + 1;
+            push(queue, {&detached<F>::run, d, 0, 0});
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+            }
+            wake.notify_one();
+        }
+
+        /** Runs one queued task on the calling thread, if there is one
+         * \return Whether a task was run */
+        bool help()
+        {
+            task t;
+            if(!take(0, t))
+                return false;
+            t.run(t.context, t.begin, t.end);
+            return true;
+        }
+
+        /** Calls body(i) for every i in [0, n) and waits for all calls to
+         * return
+         *
+         * The calls are made concurrently from the workers and the calling
+         * thread, in no particular order. If a call throws, the first
+         * exception is rethrown once all tasks are done.
+         * \param n The number of indices
+         * \param body The function to call */
+        template<typename F>
+        void parallel_for(std::size_t n, F body)
+        {
+            if(n == 0)
+                return;
+            if(threads.empty())
+            {
+                for(std::size_t i = 0; i < n; i++)
+                    body(i);
+                return;
+            }
+            // Several chunks per thread, so that stealing can even out
+            // uneven costs
+            std::size_t grain = n / (8 * size());
+            if(grain == 0)
+                grain = 1;
+            std::size_t chunks = (n + grain - 1) / grain;
+
+            job<F> j;
+            j.body = &body;
+            j.remaining = chunks;
+            for(std::size_t c = 0; c < chunks; c++)
+            {
+                std::size_t begin = c * grain;
+                std::size_t end = begin + grain < n ? begin + grain : n;
+                push(next_queue.fetch_add(1) % queues.size(),
+                     {&job<F>::run, &j, begin, end});
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+            }
+            wake.notify_all();
+
+            // Help until every chunk of this job is done
+            task t;
+            while(j.remaining.load(std::memory_order_acquire) > 0)
+            {
+                if(take(0, t))
+                    t.run(t.context, t.begin, t.end);
+                else
+                    std::this_thread::yield();
+            }
+            if(j.error)
+                std::rethrow_exception(j.error);
+        }
+};
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/** Channel carrying messages between the workers of a distributed run
+ *
+ * A transport has numbered endpoints, each with a queue of messages.
+ * Messages are byte strings, delivered whole and in the order they were
+ * sent by each sender. Neither send nor receive waits: a message that
+ * cannot be queued is dropped, and the sender decides whether to retry.
+ * Migrations tolerate lost messages, only the end of a run retries. */
+class MigrationTransport
+{
+    public:
+        virtual ~MigrationTransport() {}
+
+        /** Queues a message for an endpoint
+         * \param endpoint The destination
+         * \param message The bytes of the message
+         * \return Whether the message was queued, false if the queue of
+         * the endpoint is full or the endpoint does not exist (yet) */
+        virtual bool send(unsigned int endpoint,
+                          const std::vector<char> &message) = 0;
+
+        /** Takes the oldest message of an endpoint
+         * \param endpoint The endpoint, which must be one this process
+         * receives for
+         * \param message Replaced by the message
+         * \return Whether there was a message */
+        virtual bool receive(unsigned int endpoint,
+                             std::vector<char> &message) = 0;
+};
+
+/** Transport between threads of one process, to test distributed runs
+ * without starting processes */
+class LocalTransport : public MigrationTransport
+{
+    private:
+        struct mailbox
+        {
+            std::mutex mutex;
+            std::deque<std::vector<char>> messages;
+        };
+
+        std::vector<std::unique_ptr<mailbox>> mailboxes;
+        /// The maximal number of queued messages per endpoint
+        std::size_t capacity;
+
+    public:
+        /** Constructor for LocalTransport
+         * \param endpoints The number of endpoints
+         * \param capacity The maximal number of queued messages of each
+         * endpoint */
+        explicit LocalTransport(unsigned int endpoints,
+                                std::size_t capacity = 1024)
+            : capacity(capacity)
+        {
+            for(unsigned int i = 0; i < endpoints; i++)
+                mailboxes.emplace_back(new mailbox());
+        }
+
+        bool send(unsigned int endpoint, const std::vector<char> &message)
+        {
+            if(endpoint >= mailboxes.size())
+                return false;
+            std::lock_guard<std::mutex> lock(mailboxes[endpoint]->mutex);
+            if(mailboxes[endpoint]->messages.size() >= capacity)
+                return false;
+            mailboxes[endpoint]->messages.push_back(message);
+            return true;
+        }
+
+        bool receive(unsigned int endpoint, std::vector<char> &message)
+        {
+            if(endpoint >= mailboxes.size())
+                return false;
+            std::lock_guard<std::mutex> lock(mailboxes[endpoint]->mutex);
+            if(mailboxes[endpoint]->messages.empty())
+                return false;
+            message.swap(mailboxes[endpoint]->messages.front());
+            mailboxes[endpoint]->messages.pop_front();
+            return true;
+        }
+};
+
+/** Transport between processes of one host through a POSIX shared memory
+ * object
+ *
+ * Each endpoint has a ring buffer of bytes in the shared memory, protected
+ * by a process-shared mutex, where each message is stored as its length
+ * followed by its bytes. A message is thus copied once by the sender and
+ * once by the receiver, without any system call.
+ *
+ * One process creates the object, before the workers are started, and
+ * removes it when destroyed. Forked workers inherit the mapping, other
+ * processes open it by name. */
+class SharedMemoryTransport : public MigrationTransport
+{
+    private:
+        static const std::uint32_t magic = 0x53505047; // "GPPS"
+
+        struct segment_header
+        {
+            std::uint32_t magic;
+            std::uint32_t endpoints;
+            std::uint64_t capacity;
+        };
+
+        /// The header of the ring of an endpoint, followed by its bytes
+        struct alignas(64) ring_header
+        {
+            pthread_mutex_t mutex;
+            /// The number of bytes read and written since the creation,
+            /// the ring holds the bytes in [head, tail)
+            std::uint64_t head;
+            std::uint64_t tail;
+        };
+
+        std::string name;
+        char *data = nullptr;
+        std::size_t length = 0;
+        unsigned int endpoints = 0;
+        std::size_t capacity = 0;
+        /// The process that created the object and removes it, 0 if none
+        pid_t owner = 0;
+
+        static std::size_t ring_bytes(std::size_t capacity)
+        {
+            return (sizeof(ring_header) + capacity + alignof(ring_header) - 1)
+                / alignof(ring_header) * alignof(ring_header);
+        }
+
+        static std::size_t header_bytes()
+        {
+            return (sizeof(segment_header) + alignof(ring_header) - 1)
+                / alignof(ring_header) * alignof(ring_header);
+        }
+
+        ring_header * ring(unsigned int endpoint) const
+        {
+            return reinterpret_cast<ring_header*>(data + header_bytes()
+                    + endpoint * ring_bytes(capacity));
+        }
+
+        char * ring_data(unsigned int endpoint) const
+        { return reinterpret_cast<char*>(ring(endpoint) + 1); }
+
+        /** Copies bytes into a ring at a position, wrapping around */
+        void write_ring(unsigned int endpoint, std::uint64_t position,
+                        const char *bytes, std::size_t count)
+        {
+            std::size_t offset = position % capacity;
+            std::size_t first = std::min(count, capacity - offset);
+            std::memcpy(ring_data(endpoint) + offset, bytes, first);
+            std::memcpy(ring_data(endpoint), bytes + first, count - first);
+        }
+
+        /** Copies bytes out of a ring from a position, wrapping around */
+        void read_ring(unsigned int endpoint, std::uint64_t position,
+                       char *bytes, std::size_t count) const
+        {
+            std::size_t offset = position % capacity;
+            std::size_t first = std::min(count, capacity - offset);
+            std::memcpy(bytes, ring_data(endpoint) + offset, first);
+            std::memcpy(bytes + first, ring_data(endpoint), count - first);
+        }
+
+        /** Locks a ring
+         *
+         * The mutex is robust: if a process died holding it, the messages
+         * of the ring may be partly written or read, so they are dropped. */
+        void lock(ring_header *r)
+        {
+            if(pthread_mutex_lock(&r->mutex) == EOWNERDEAD)
+            {
+                r->head = r->tail;
+                pthread_mutex_consistent(&r->mutex);
+            }
+        }
+
+        void map(int fd, std::size_t size)
+        {
+            void *mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, 0);
+            int error = errno;
+            ::close(fd);
+            if(mapped == MAP_FAILED)
+                throw std::runtime_error("cannot map " + name + ": "
+                                         + std::strerror(error));
+            data = static_cast<char*>(mapped);
+            length = size;
+        }
+
+    public:
+        /** Creates the shared memory object
+         * \param name The name of the object, starting with a slash
+         * \param endpoints The number of endpoints
+         * \param capacity The number of bytes of the ring of each endpoint
+         * \throw std::runtime_error If the object cannot be created, for
+         * example because it already exists */
+        SharedMemoryTransport(const std::string &name, unsigned int endpoints,
+                              std::size_t capacity = 1 << 20)
+            : name(name), endpoints(endpoints), capacity(capacity),
+            owner(::getpid())
+        {
+            int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if(fd < 0)
+                throw std::runtime_error("cannot create " + name + ": "
+                                         + std::strerror(errno));
+            std::size_t size = header_bytes()
+                + endpoints * ring_bytes(capacity);
+            if(::ftruncate(fd, size) != 0)
+            {
+                int error = errno;
+                ::close(fd);
+                ::shm_unlink(name.c_str());
+                throw std::runtime_error("cannot size " + name + ": "
+                                         + std::strerror(error));
+            }
+            try
+            {
+                map(fd, size);
+            }
+            catch(...)
+            {
+                ::shm_unlink(name.c_str());
+                throw;
+            }
+            pthread_mutexattr_t attributes;
+            pthread_mutexattr_init(&attributes);
+            pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+            // A worker killed while holding a lock must not block the others
+            pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+            for(unsigned int i = 0; i < endpoints; i++)
+            {
+                pthread_mutex_init(&ring(i)->mutex, &attributes);
+                ring(i)->head = 0;
+                ring(i)->tail = 0;
+            }
+            pthread_mutexattr_destroy(&attributes);
+            segment_header *header = reinterpret_cast<segment_header*>(data);
+            header->endpoints = endpoints;
+            header->capacity = capacity;
+            // Written last, so that a process opening the object early
+            // rejects it rather than using uninitialized rings
+            std::atomic_thread_fence(std::memory_order_release);
+            header->magic = magic;
+        }
+
+        /** Opens a shared memory object created by another process
+         * \param name The name of the object
+         * \throw std::runtime_error If the object cannot be opened or is
+         * not a transport */
+        explicit SharedMemoryTransport(const std::string &name) : name(name)
+        {
+            int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+            if(fd < 0)
+                throw std::runtime_error("cannot open " + name + ": "
+                                         + std::strerror(errno));
+            struct stat status;
+            if(::fstat(fd, &status) != 0
+               || (std::size_t)status.st_size < header_bytes())
+            {
+                ::close(fd);
+                throw std::runtime_error(name + " is not a transport");
+            }
+            map(fd, status.st_size);
+            const segment_header *header =
+                reinterpret_cast<const segment_header*>(data);
+            // The fields are valid once magic is, see the other constructor
+            bool valid = header->magic == magic;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            endpoints = header->endpoints;
+            capacity = header->capacity;
+            if(!valid || capacity == 0 || length < header_bytes()
+               + endpoints * ring_bytes(capacity))
+            {
+                ::munmap(data, length);
+                data = nullptr;
+                throw std::runtime_error(name + " is not a transport");
+            }
+        }
+
+        SharedMemoryTransport(const SharedMemoryTransport &) = delete;
+        SharedMemoryTransport & operator=(const SharedMemoryTransport &)
+            = delete;
+
+        ~SharedMemoryTransport()
+        {
+            if(data)
+                ::munmap(data, length);
+            // Forked workers inherit the object, only its creator removes
+            // it
+            if(owner == ::getpid())
+                ::shm_unlink(name.c_str());
+        }
+
+        bool send(unsigned int endpoint, const std::vector<char> &message)
+        {
+            if(endpoint >= endpoints)
+                return false;
+            std::uint32_t size = message.size();
+            ring_header *r = ring(endpoint);
+            lock(r);
+            bool fits = capacity - (r->tail - r->head)
+                        >= sizeof(size) + message.size();
+            if(fits)
+            {
+                write_ring(endpoint, r->tail, (const char*)&size,
+                           sizeof(size));
+                write_ring(endpoint, r->tail + sizeof(size), message.data(),
+                           message.size());
+                r->tail += sizeof(size) + message.size();
+            }
+            pthread_mutex_unlock(&r->mutex);
+            return fits;
+        }
+
+        bool receive(unsigned int endpoint, std::vector<char> &message)
+        {
+            if(endpoint >= endpoints)
+                return false;
+            ring_header *r = ring(endpoint);
+            lock(r);
+            bool found = r->head != r->tail;
+            if(found)
+            {
+                std::uint32_t size;
+                read_ring(endpoint, r->head, (char*)&size, sizeof(size));
+                message.resize(size);
+                read_ring(endpoint, r->head + sizeof(size), message.data(),
+                          size);
+                r->head += sizeof(size) + size;
+            }
+            pthread_mutex_unlock(&r->mutex);
+            return found;
+        }
+};
+
+/** Transport between processes through Unix domain datagram sockets
+ *
+ * Each process binds the socket of its own endpoint, a file in a given
+ * directory, and can only receive for that endpoint. The queues are the
+ * ones of the kernel, so the size of a message is limited by the socket
+ * buffers (about 200 kB by default). Unlike shared memory, this also works
+ * between containers sharing a directory. */
+class SocketTransport : public MigrationTransport
+{
+    private:
+        std::string directory;
+        unsigned int endpoint;
+        int fd = -1;
+
+        sockaddr_un address(unsigned int index) const
+        {
+            std::string path = directory + "/island-"
+                + std::to_string(index) + ".sock";
+            sockaddr_un result;
+            std::memset(&result, 0, sizeof(result));
+            result.sun_family = AF_UNIX;
+            if(path.size() >= sizeof(result.sun_path))
+                throw std::runtime_error("socket path too long: " + path);
+            std::memcpy(result.sun_path, path.c_str(), path.size());
+            return result;
+        }
+
+    public:
+        /** Binds the socket of an endpoint
+         * \param directory The directory holding the sockets of all the
+         * endpoints
+         * \param endpoint The endpoint this process receives for
+         * \throw std::runtime_error If the socket cannot be bound */
+        SocketTransport(const std::string &directory, unsigned int endpoint)
+            : directory(directory), endpoint(endpoint)
+        {
+            sockaddr_un own = address(endpoint);
+            fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0);
+            if(fd < 0)
+                throw std::runtime_error(std::string("cannot create socket: ")
+                                         + std::strerror(errno));
+            // A socket file left by a previous run is replaced
+            ::unlink(own.sun_path);
+            if(::bind(fd, (const sockaddr*)&own, sizeof(own)) != 0)
+            {
+                int error = errno;
+                ::close(fd);
+                throw std::runtime_error(std::string("cannot bind ")
+                                         + own.sun_path + ": "
+                                         + std::strerror(error));
+            }
+        }
+
+        SocketTransport(const SocketTransport &) = delete;
+        SocketTransport & operator=(const SocketTransport &) = delete;
+
+        ~SocketTransport()
+        {
+            ::close(fd);
+            ::unlink(address(endpoint).sun_path);
+        }
+
+        bool send(unsigned int destination, const std::vector<char> &message)
+        {
+            sockaddr_un to = address(destination);
+            ssize_t sent;
+            do
+                sent = ::sendto(fd, message.data(), message.size(), 0,
+                                (const sockaddr*)&to, sizeof(to));
+            while(sent < 0 && errno == EINTR);
+            return sent == (ssize_t)message.size();
+        }
+
+        bool receive(unsigned int index, std::vector<char> &message)
+        {
+            if(index != endpoint)
+                return false;
+            // MSG_TRUNC makes a peek return the whole size of the datagram
+            ssize_t size;
+            do
+                size = ::recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+            while(size < 0 && errno == EINTR);
+            if(size < 0)
+                return false;
+            message.resize(size);
+            do
+                size = ::recv(fd, message.data(), message.size(), 0);
+            while(size < 0 && errno == EINTR);
+            if(size < 0)
+                return false;
+            message.resize(size);
+            return true;
+        }
+};
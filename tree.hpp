@@ -1,45 +1,216 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <functional>
+#include <initializer_list>
 #include <iostream>
-#include <list>
 #include <memory>
 #include <random>
 #include <tuple>
 #include <vector>
 
-typedef std::list<unsigned int> pos;
+#include "arena.hpp"
+#include "random.hpp"
+
+/** A position in a tree: the indices of the children to follow from the
+ * root, the root itself being at the empty position
+ *
+ * Up to inline_capacity indices are stored in the object itself, so that
+ * positions in trees of usual depths never allocate. Deeper positions move
+ * their indices to the heap. */
+class pos
+{
+    public:
+        typedef unsigned int value_type;
+        typedef const unsigned int * const_iterator;
+        /// The depth up to which a position does not allocate
+        static const unsigned int inline_capacity = 14;
+
+    private:
+        unsigned int length = 0;
+        unsigned int inline_indices[inline_capacity] = {};
+        /// The indices, once there are more than inline_capacity of them
+        std::vector<unsigned int> spilled;
+
+        unsigned int * data()
+        { return spilled.empty() ? inline_indices : spilled.data(); }
+        const unsigned int * data() const
+        { return spilled.empty() ? inline_indices : spilled.data(); }
+
+    public:
+        pos() {}
+        pos(std::initializer_list<unsigned int> indices)
+        {
+            for(unsigned int index : indices)
+                push_back(index);
+        }
+
+        unsigned int size() const { return length; }
+        bool empty() const { return length == 0; }
+
+        const_iterator begin() const { return data(); }
+        const_iterator end() const { return data() + length; }
+
+        unsigned int operator[](unsigned int depth) const
+        { return data()[depth]; }
+        unsigned int front() const { return data()[0]; }
+        unsigned int back() const { return data()[length - 1]; }
+
+        /** Appends the index of a child to the position */
+        void push_back(unsigned int index)
+        {
+            if(spilled.empty() && length == inline_capacity)
+                spilled.assign(inline_indices, inline_indices + length);
+            if(spilled.empty())
+                inline_indices[length] = index;
+            else if(length < spilled.size())
+                spilled[length] = index;
+            else
+                spilled.push_back(index);
+            length++;
+        }
+
+        /** Removes the last index, the position becomes the one of the
+         * parent */
+        void pop_back() { length--; }
+
+        void clear() { length = 0; }
+
+        bool operator==(const pos &other) const
+        {
+            return length == other.length
+                && std::equal(begin(), end(), other.begin());
+        }
+        bool operator!=(const pos &other) const { return !(*this == other); }
+        bool operator<(const pos &other) const
+        {
+            return std::lexicographical_compare(begin(), end(),
+                                                other.begin(), other.end());
+        }
+};
+
+/** Mixes a value into a hash
+ * \param seed The hash so far
+ * \param value The value to mix in
+ * \return The new hash */
+inline std::uint64_t hash_combine(std::uint64_t seed, std::uint64_t value)
+{
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+/** Computes the structural hash of a node from the hashes of its children
+ *
+ * The value of the node is hashed with std::hash<T>, and its type is
+ * converted to an integer, so node_type_t must be an enumeration or an
+ * integral type. */
+template<typename T, typename node_type_t>
+struct node_hasher
+{
+    std::uint64_t hash;
+
+    node_hasher(const T &node, node_type_t type)
+        : hash(hash_combine(std::hash<T>()(node),
+                            static_cast<std::uint64_t>(type))) {}
+
+    void add_child(std::uint64_t child) { hash = hash_combine(hash, child); }
+};
+
+/** The number of values of a node type
+ *
+ * Specializing it for an enumeration whose values are 0 to value - 1 makes
+ * every Tree node count the nodes of each type in its subtree, so that
+ * random_position(type) runs in O(depth). Otherwise these counts are
+ * recomputed by each call. */
+template<typename node_type_t>
+struct node_type_count
+{
+    static const unsigned int value = 0;
+};
 
 /** A tree holding values of type T
  *
  * This class represents a tree (as in a graph without cycles) with
- * values of type T attached to the nodes. */
+ * values of type T attached to the nodes.
+ *
+ * Subtrees are shared between trees: copying a tree or replacing one of
+ * its subtrees by another tree does not copy the nodes below. replace
+ * copies the nodes on its path that are shared before modifying them
+ * (path copying), so a tree never sees the modifications made to another
+ * one. The root itself is modified in place, so it must be owned by the
+ * caller only. */
 template<typename T, typename node_type_t>
 class Tree
 {
+    public:
+        /// The type of the array of children, allocated like the nodes
+        typedef std::vector<std::shared_ptr<Tree<T,node_type_t>>,
+                tree_allocator<std::shared_ptr<Tree<T,node_type_t>>>>
+                    children_t;
+
     private:
         /// The value of type T attached to that node.
         T node;
         /// The type of the node
         node_type_t type;
         /// The array of children of that node.
-        std::vector<std::shared_ptr<Tree<T,node_type_t>>> children;
+        children_t children;
+        /// The structural hash of the subtree rooted at that node.
+        std::uint64_t hash;
+        /// The number of nodes in the subtree rooted at that node (itself
+        /// included).
+        unsigned int size;
+        /// The number of levels of the subtree rooted at that node, 1 for
+        /// a leaf.
+        unsigned int depth;
+        /// The number of nodes of each type in the subtree rooted at that
+        /// node, empty if node_type_count is not specialized.
+        std::array<unsigned int, node_type_count<node_type_t>::value>
+            type_counts;
+
+        /** Recomputes the hash, size, depth and type counts of that node
+         * from the ones of its children */
+        void update()
+        {
+            node_hasher<T,node_type_t> hasher(node, type);
+            size = 1;
+            depth = 1;
+            type_counts.fill(0);
+            if(!type_counts.empty())
+                type_counts[static_cast<unsigned int>(type)] = 1;
+            for(auto &child : children)
+            {
+                hasher.add_child(child->hash);
+                size += child->size;
+                if(child->depth + 1 > depth)
+                    depth = child->depth + 1;
+                for(unsigned int i = 0; i < type_counts.size(); i++)
+                    type_counts[i] += child->type_counts[i];
+            }
+            hash = hasher.hash;
+        }
+
+        /** Replaces the subtree at position, position[depth] being the
+         * index of the child of that node to descend into */
+        void replace(const std::shared_ptr<Tree<T,node_type_t>> &newtree,
+                     const pos &position, unsigned int depth);
 
         /** Depth-first visitor for a tree
          *
          * This nested class represents a visitor, visiting the nodes of a
-         * tree depth-first and applying the provided void(pos) function
-         * to each node.
-         *
-         * TODO maybe change the function from void(pos)
-         * to void(tree_ptr<T>,pos) ? */
+         * tree depth-first and applying the provided void(node,pos)
+         * function to each node. A single position is updated in place
+         * during the traversal and passed by reference. */
         class visitor
         {
             private:
                 /// The root of the visited tree
                 Tree<T,node_type_t>* root;
                 /// The function applied to each node
-                std::function<void(Tree<T,node_type_t>*,pos)> visit;
+                std::function<void(Tree<T,node_type_t>*,const pos&)> visit;
 
                 /** This function recursively applies visit(pos) to the tree
                  * \param node The next node to be visited and whose children
@@ -63,40 +234,64 @@ class Tree
                  * \param visit The function which will be applied to the nodes
                  */
                 visitor(Tree<T,node_type_t>* root,
-                        std::function<void(Tree<T,node_type_t>*,pos)> visit)
+                        std::function<void(Tree<T,node_type_t>*,const pos&)> visit)
                     : root(root), visit(visit) {}
 
                 /** This function runs the visitor and applies visit(pos) to
                  * each node */
                 void accept()
                 {
-                    pos p = {};
+                    pos p;
                     accept(root, p);
                 }
         };
 
     public:
-        Tree(T node, node_type_t type) : node(node), type(type) {}
+        Tree(T node, node_type_t type) : node(node), type(type)
+        { update(); }
         Tree(T node, node_type_t type,
              std::vector<std::shared_ptr<Tree<T,node_type_t>>> children)
-            : node(node), type(type), children(children) {}
-        /** Copy constructor */
+            : node(node), type(type), children(children.begin(), children.end())
+        { update(); }
+        /** Copy constructor
+         *
+         * Only the root is copied, in the current arena (see make_tree).
+         * The subtrees are shared with the copied tree. */
         Tree(const Tree<T,node_type_t> &copy)
-            : node(T(copy.node)), type(copy.type)
+            : node(T(copy.node)), type(copy.type),
+            children(copy.children.begin(), copy.children.end()),
+            hash(copy.hash), size(copy.size), depth(copy.depth),
+            type_counts(copy.type_counts)
+        {}
+
+        /** Copies the whole tree, in the current arena (see make_tree)
+         *
+         * The copy does not share any node with this tree, so it can be
+         * handed to another thread or outlive the arena of this tree.
+         * \return The copy */
+        std::shared_ptr<Tree<T,node_type_t>> clone() const
         {
-            for(auto child : copy.children)
-            {
-                auto child_copy = std::make_shared<Tree<T,node_type_t>>(*child);
-                children.push_back(child_copy);
-            }
+            auto copy = make_tree<Tree<T,node_type_t>>(*this);
+            for(auto &child : copy->children)
+                child = child->clone();
+            return copy;
         }
 
         /** Adds given children to the children of the tree
+         *
+         * The node is modified in place, this is meant for building trees.
          * \param child The child to add */
         void add(std::shared_ptr<Tree<T,node_type_t>> child)
-        { children.push_back(child); }
+        {
+            children.push_back(child);
+            update();
+        }
 
         /** Getter for the value of type T attached to the node
+         *
+         * Modifying the value through this reference does not update the
+         * hashes of the node and its ancestors, and is seen by every tree
+         * sharing the node.
          * \return A reference to the held value */
         T & get_node() { return node; }
         /** Const getter for the value of type T attached to the node
@@ -107,50 +302,90 @@ class Tree
         node_type_t get_type() const { return type; }
         /** Getter for children of that node
          * \return A reference to the array of children */
-        const std::vector<std::shared_ptr<Tree<T,node_type_t>>> & get_children() const
-        { return children; }
+        const children_t & get_children() const { return children; }
+        /** Getter for the structural hash of the tree
+         *
+         * Trees with the same values, types and shape have the same hash.
+         * It is stored in every node and kept up to date by add and
+         * replace, so getting it is O(1).
+         * \return The hash */
+        std::uint64_t get_hash() const { return hash; }
+        /** Getter for the number of nodes in the tree, in O(1) */
+        unsigned int get_size() const { return size; }
+        /** Getter for the number of levels of the tree, 1 for a leaf, in
+         * O(1) */
+        unsigned int get_depth() const { return depth; }
+        /** Getter for the number of nodes of a given type in the tree
+         *
+         * This is O(1) if node_type_count is specialized for node_type_t,
+         * and a traversal of the tree otherwise. */
+        unsigned int get_count(node_type_t type) const
+        {
+            if(!type_counts.empty())
+                return type_counts[static_cast<unsigned int>(type)];
+            unsigned int count = this->type == type ? 1 : 0;
+            for(auto &child : children)
+                count += child->get_count(type);
+            return count;
+        }
         /** Getter for a particular subtree of that tree
          * \param position The position of the subtree to return within that
-         * tree
+         * tree, which must not be the root
          * \return A pointer to the corresponding subtree
          *
          * TODO behavior when the position is outside of the bounds */
-        std::shared_ptr<Tree<T,node_type_t>> get_subtree(pos &position)
+        std::shared_ptr<Tree<T,node_type_t>> get_subtree(
+                const pos &position) const
         {
-            unsigned int i = position.front();
-            if(position.size() == 1)
-            {
-                return children[i];
-            }
-            else
-            {
-                position.pop_front();
-                return children[i]->get_subtree(position);
-            }
+            const Tree<T,node_type_t> *current = this;
+            for(unsigned int depth = 0; depth + 1 < position.size(); depth++)
+                current = current->children[position[depth]].get();
+            return current->children[position.back()];
         }
 
         /** This function applies visit_func to all nodes depth-first
          * \param visit_func The function to apply to each node */
-        void visit(std::function<void(Tree<T,node_type_t>*,pos)> visit_func)
+        void visit(
+                std::function<void(Tree<T,node_type_t>*,const pos&)> visit_func)
         { visitor(this, visit_func).accept(); }
 
         /** This function replaces the subtree at a given position by
          * another tree
+         *
+         * newtree is shared, not copied. The nodes between the root and the
+         * position that are shared with other trees are copied first, so
+         * the replacement allocates at most O(depth) nodes.
          * \param newtree The tree that will replace the subtree
          * \param position The positon at which the replacement will
          * be made */
-        void replace(std::shared_ptr<Tree<T,node_type_t>> &newtree, pos &position);
+        void replace(const std::shared_ptr<Tree<T,node_type_t>> &newtree,
+                     const pos &position)
+        { replace(newtree, position, 0); }
 
         /** This function returns a uniformly distributed random position
          * whose subtree is of given type  within the tree
+         *
+         * It takes a single random draw and descends from the root using
+         * the type counts of the nodes.
          * \param type The type of the subtree to get
+         * \param gen The random number generator to use
          * \return A tuple (has_found,position) */
-        std::pair<bool,pos> random_position(node_type_t type);
+        template<typename rng_t>
+        std::pair<bool,pos> random_position(node_type_t type,
+                                            rng_t &gen) const;
+        std::pair<bool,pos> random_position(node_type_t type)
+        { return random_position(type, thread_generator()); }
 
         /** This function returns a uniformly distributed random position
          * within the tree
+         *
+         * It takes a single random draw and descends from the root using
+         * the sizes of the subtrees, in O(depth).
+         * \param gen The random number generator to use
          * \return The position */
-        pos random_position();
+        template<typename rng_t>
+        pos random_position(rng_t &gen) const;
+        pos random_position() { return random_position(thread_generator()); }
 
         /** Output function */
         template<typename U, typename Unode_type_t>
@@ -160,90 +395,92 @@ class Tree
 
 template<typename T, typename node_type_t>
 void Tree<T,node_type_t>::replace(
-        std::shared_ptr<Tree<T,node_type_t>> &newtree,
-        std::list<unsigned int> &position)
+        const std::shared_ptr<Tree<T,node_type_t>> &newtree,
+        const pos &position, unsigned int depth)
 {
-    unsigned int i = position.front();
-    if(position.size() == 1)
+    unsigned int i = position[depth];
+    if(depth + 1 == position.size())
     {
-        children[i] = std::make_shared<Tree<T,node_type_t>>(*newtree);
+        children[i] = newtree;
     }
     else
     {
-        position.pop_front();
-        children[i]->replace(newtree, position);
+        // A child owned by other trees too is copied before being modified
+        if(children[i].use_count() > 1)
+            children[i] = make_tree<Tree<T,node_type_t>>(*children[i]);
+        children[i]->replace(newtree, position, depth + 1);
     }
+    // Only the nodes on the path to the replaced subtree are updated
+    update();
 }
 
 template<typename T, typename node_type_t>
-class reservoir_sampler
+template<typename rng_t>
+pos Tree<T,node_type_t>::random_position(rng_t &gen) const
 {
-    private:
-        unsigned int i = 1;
-        Tree<T,node_type_t>* tree;
-        pos position;
-        std::function<bool(Tree<T,node_type_t>*)> filter;
-        std::random_device rd;
-        std::mt19937 gen;
-        std::uniform_real_distribution<> dis;
-    public:
-        reservoir_sampler(
-                std::function<bool(Tree<T,node_type_t>*)> filter)
-            : filter(filter), gen(rd()), dis(0,1) {}
-        void operator()(Tree<T,node_type_t>* subtree, pos position)
+    std::uniform_int_distribution<unsigned int> dis(0, size - 1);
+    // The index of the chosen node in the prefix order of the current
+    // subtree
+    unsigned int index = dis(gen);
+    pos position;
+    const Tree<T,node_type_t> *current = this;
+    while(index > 0)
+    {
+        index--;
+        for(unsigned int i = 0;; i++)
         {
-            if(filter(subtree))
+            const Tree<T,node_type_t> *child = current->children[i].get();
+            if(index < child->size)
             {
-                if(dis(gen) < (1.0 / (double)i))
-                {
-                    this->tree = subtree;
-                    this->position = position;
-                }
-                i++;
+                position.push_back(i);
+                current = child;
+                break;
             }
+            index -= child->size;
         }
-        Tree<T,node_type_t>* get_tree() const
-        { return tree; }
-        pos get_position() const { return position; }
-        const unsigned int get_iterations() const { return i; }
-};
-
-template<typename T, typename node_type_t>
-bool any_filter(Tree<T,node_type_t>* tree)
-{ return true; }
-
-template<typename T, typename node_type_t>
-struct type_filter
-{
-    private:
-        node_type_t type;
-    public:
-        type_filter(node_type_t type) : type(type) {}
-        bool operator()(Tree<T,node_type_t>* tree)
-        { return tree->get_type() == type; }
-};
-
-template<typename T, typename node_type_t>
-pos Tree<T,node_type_t>::random_position()
-{
-    reservoir_sampler<T, node_type_t> rs{&any_filter<T,node_type_t>};
-    visit(std::ref(rs));
-    return rs.get_position();
+    }
+    return position;
 }
 
 template<typename T, typename node_type_t>
-std::pair<bool,pos> Tree<T,node_type_t>::random_position(node_type_t type)
+template<typename rng_t>
+std::pair<bool,pos> Tree<T,node_type_t>::random_position(
+        node_type_t type, rng_t &gen) const
 {
-    reservoir_sampler<T, node_type_t> rs{type_filter<T,node_type_t>(type)};
-    visit(std::ref(rs));
-    return std::pair<bool,pos>(rs.get_iterations() > 0, rs.get_position());
+    unsigned int count = get_count(type);
+    if(count == 0)
+        return std::pair<bool,pos>(false, pos());
+    std::uniform_int_distribution<unsigned int> dis(0, count - 1);
+    // The index of the chosen node among the nodes of the given type of
+    // the current subtree, in prefix order
+    unsigned int index = dis(gen);
+    pos position;
+    const Tree<T,node_type_t> *current = this;
+    while(current->type != type || index > 0)
+    {
+        if(current->type == type)
+            index--;
+        for(unsigned int i = 0;; i++)
+        {
+            const Tree<T,node_type_t> *child = current->children[i].get();
+            unsigned int matches = child->get_count(type);
+            if(index < matches)
+            {
+                position.push_back(i);
+                current = child;
+                break;
+            }
+            index -= matches;
+        }
+    }
+    return std::pair<bool,pos>(true, position);
 }
 
 template<typename T, typename node_type_t>
 std::ostream & operator<<(std::ostream & os, const Tree<T,node_type_t> & tree)
 {
     os << tree.node << "(";
-    for(auto child : tree.children)
+    for(auto &child : tree.children)
         os << *child << ",";
     os << ")";
     return os;